@@ -0,0 +1,157 @@
+/**
+ * @file aesd-circular-buffer-spmc.c
+ * @brief Lock-free single producer, multiple consumer circular buffer
+ *
+ * See aesd-circular-buffer-spmc.h.  Slot fields are relaxed atomics so readers
+ * racing the writer are well defined, the slot's version orders them.
+ */
+
+#include <string.h>
+#include "aesd-circular-buffer-spmc.h"
+
+/**
+ * Copy entry @param seq out of its slot in @param ring into @param entry.
+ * @return AESD_SPMC_OK, AESD_SPMC_OVERWRITTEN if the slot holds or is being filled
+ * with a newer entry, AESD_SPMC_NOT_WRITTEN if it does not hold @param seq yet
+ */
+static enum aesd_spmc_status read_slot(struct aesd_circular_buffer_spmc *ring, uint64_t seq,
+            struct aesd_spmc_entry *entry)
+{
+    struct aesd_spmc_slot *slot = &ring->slot[seq % ring->capacity];
+    uint64_t version = atomic_load_explicit(&slot->version, memory_order_acquire);
+
+    if (version != 2 * seq + 2)
+        return version > 2 * seq + 2 ? AESD_SPMC_OVERWRITTEN : AESD_SPMC_NOT_WRITTEN;
+
+    entry->buffptr = atomic_load_explicit(&slot->buffptr, memory_order_relaxed);
+    entry->size = atomic_load_explicit(&slot->size, memory_order_relaxed);
+    entry->offs = atomic_load_explicit(&slot->offs, memory_order_relaxed);
+    entry->seq = seq;
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->version, memory_order_relaxed) != version)
+        return AESD_SPMC_OVERWRITTEN;
+    return AESD_SPMC_OK;
+}
+
+/**
+ * Initializes @param ring to an empty buffer storing up to @param capacity entries
+ * in @param storage, whose lifetime is managed by the caller.
+ * Must complete before the writer and readers start.
+ */
+void aesd_circular_buffer_spmc_init(struct aesd_circular_buffer_spmc *ring,
+            struct aesd_spmc_slot *storage, uint32_t capacity)
+{
+    uint32_t i;
+
+    ring->slot = storage;
+    ring->capacity = capacity;
+    for (i = 0; i < capacity; i++) {
+        atomic_init(&storage[i].version, 0);
+        atomic_init(&storage[i].buffptr, NULL);
+        atomic_init(&storage[i].size, 0);
+        atomic_init(&storage[i].offs, 0);
+    }
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->head_offs, 0);
+}
+
+/**
+ * Adds the @param size bytes at @param buffptr to @param ring, overwriting the oldest
+ * entry if the ring is full.  Only one thread may add to a ring.
+ * @return the stream position of the first byte of the added entry
+ */
+size_t aesd_circular_buffer_spmc_add(struct aesd_circular_buffer_spmc *ring,
+            const char *buffptr, size_t size)
+{
+    uint64_t seq = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t offs = atomic_load_explicit(&ring->head_offs, memory_order_relaxed);
+    struct aesd_spmc_slot *slot = &ring->slot[seq % ring->capacity];
+
+    // Readers seeing the odd version, or the fields changing under them, retry or give up
+    atomic_store_explicit(&slot->version, 2 * seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&slot->buffptr, buffptr, memory_order_relaxed);
+    atomic_store_explicit(&slot->size, size, memory_order_relaxed);
+    atomic_store_explicit(&slot->offs, offs, memory_order_relaxed);
+    atomic_store_explicit(&slot->version, 2 * seq + 2, memory_order_release);
+
+    // A reader seeing the new head_offs also sees the new head
+    atomic_store_explicit(&ring->head, seq + 1, memory_order_release);
+    atomic_store_explicit(&ring->head_offs, offs + size, memory_order_release);
+    return offs;
+}
+
+/**
+ * Copies the entry with sequence number @param seq, the number of entries added before it,
+ * out of @param ring into @param entry.  Safe to call concurrently with the writer.
+ * @return AESD_SPMC_OK, AESD_SPMC_OVERWRITTEN if the entry is no longer stored or is
+ * being overwritten, or AESD_SPMC_NOT_WRITTEN if it has not been added yet
+ */
+enum aesd_spmc_status aesd_circular_buffer_spmc_get(struct aesd_circular_buffer_spmc *ring,
+            uint64_t seq, struct aesd_spmc_entry *entry)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (seq >= head)
+        return AESD_SPMC_NOT_WRITTEN;
+    if (head - seq > ring->capacity)
+        return AESD_SPMC_OVERWRITTEN;
+    // Added before head was read, so the slot never reads as not written
+    return read_slot(ring, seq, entry);
+}
+
+/**
+ * Copies the entry holding stream position @param pos, a position in the stream of all
+ * bytes ever added, out of @param ring into @param entry, and sets
+ * @param entry_offset_byte_rtn to the offset of @param pos within it.
+ * Safe to call concurrently with the writer.  A lookup racing the writer is retried
+ * until it either finds the entry or the position has been evicted.
+ * @return AESD_SPMC_OK, AESD_SPMC_OVERWRITTEN if @param pos is older than the oldest
+ * stored entry, AESD_SPMC_NOT_WRITTEN if it follows the newest one
+ */
+enum aesd_spmc_status aesd_circular_buffer_spmc_find(struct aesd_circular_buffer_spmc *ring,
+            size_t pos, struct aesd_spmc_entry *entry, size_t *entry_offset_byte_rtn)
+{
+    struct aesd_spmc_entry probe;
+    enum aesd_spmc_status status;
+    uint64_t head, lo, hi;
+
+retry:
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == 0)
+        return AESD_SPMC_NOT_WRITTEN;
+    lo = head > ring->capacity ? head - ring->capacity : 0;
+    hi = head;
+
+    // The newest entry cannot be overwritten before the ring wraps once more
+    status = read_slot(ring, head - 1, &probe);
+    if (status != AESD_SPMC_OK)
+        goto retry;
+    if (pos >= probe.offs + probe.size)
+        return AESD_SPMC_NOT_WRITTEN;
+
+    status = read_slot(ring, lo, &probe);
+    if (status != AESD_SPMC_OK)
+        goto retry;
+    if (pos < probe.offs)
+        return AESD_SPMC_OVERWRITTEN;
+
+    // Find the newest entry starting at or before pos.  Entries are overwritten
+    // oldest first, so a probe finding its entry overwritten means lo was too.
+    while (hi - lo > 1) {
+        uint64_t mid = lo + (hi - lo) / 2;
+
+        if (read_slot(ring, mid, &probe) != AESD_SPMC_OK)
+            goto retry;
+        if (probe.offs <= pos)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    if (read_slot(ring, lo, entry) != AESD_SPMC_OK)
+        goto retry;
+    *entry_offset_byte_rtn = pos - entry->offs;
+    return AESD_SPMC_OK;
+}
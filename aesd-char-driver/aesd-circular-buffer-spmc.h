@@ -0,0 +1,123 @@
+/*
+ * aesd-circular-buffer-spmc.h
+ *
+ *  @brief Lock-free single producer, multiple consumer variant of aesd-circular-buffer
+ *
+ *  One writer adds entries while any number of readers look entries up by
+ *  stream position or sequence number, without locks on either side.  Every
+ *  slot carries the sequence number of the entry it holds, written like a
+ *  seqlock: readers copy an entry out and keep the copy only if the slot's
+ *  sequence number was the expected one before and after.  A reader whose
+ *  entry was overwritten by the writer is told so instead of seeing torn or
+ *  newer data.
+ *
+ *  User space only, built on C11 atomics.
+ */
+
+#ifndef AESD_CIRCULAR_BUFFER_SPMC_H
+#define AESD_CIRCULAR_BUFFER_SPMC_H
+
+#ifdef __KERNEL__
+#error "aesd-circular-buffer-spmc is for user space builds only"
+#endif
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * A copy of an entry, as returned to readers
+ */
+struct aesd_spmc_entry
+{
+    /**
+     * Memory owned by the writer, which may reuse it once the add overwriting
+     * this entry has returned, see aesd_circular_buffer_spmc_valid()
+     */
+    const char *buffptr;
+    size_t size;
+    /**
+     * Position of the first byte of this entry in the stream of all bytes ever added
+     */
+    size_t offs;
+    /**
+     * Number of entries added before this one
+     */
+    uint64_t seq;
+};
+
+struct aesd_spmc_slot
+{
+    /**
+     * 2 * seq + 1 while the writer fills the slot with entry seq, 2 * seq + 2
+     * once it is complete, 0 if the slot never held an entry
+     */
+    _Atomic uint64_t version;
+    _Atomic(const char *) buffptr;
+    _Atomic size_t size;
+    _Atomic size_t offs;
+};
+
+struct aesd_circular_buffer_spmc
+{
+    struct aesd_spmc_slot *slot;
+    uint32_t capacity;
+    /**
+     * Number of entries ever added, entries head - capacity to head - 1 are stored.
+     * Written only by the writer, on its own cache line as readers poll it.
+     */
+    _Alignas(64) _Atomic uint64_t head;
+    /**
+     * Stream position at which the next added entry will start
+     */
+    _Atomic size_t head_offs;
+};
+
+enum aesd_spmc_status
+{
+    AESD_SPMC_OK = 0,
+    /**
+     * The entry was overwritten, or the stream position evicted, before it could be read
+     */
+    AESD_SPMC_OVERWRITTEN,
+    /**
+     * The entry or stream position has not been written yet
+     */
+    AESD_SPMC_NOT_WRITTEN,
+};
+
+extern void aesd_circular_buffer_spmc_init(struct aesd_circular_buffer_spmc *ring,
+            struct aesd_spmc_slot *storage, uint32_t capacity);
+
+extern size_t aesd_circular_buffer_spmc_add(struct aesd_circular_buffer_spmc *ring,
+            const char *buffptr, size_t size);
+
+extern enum aesd_spmc_status aesd_circular_buffer_spmc_get(struct aesd_circular_buffer_spmc *ring,
+            uint64_t seq, struct aesd_spmc_entry *entry);
+
+extern enum aesd_spmc_status aesd_circular_buffer_spmc_find(struct aesd_circular_buffer_spmc *ring,
+            size_t pos, struct aesd_spmc_entry *entry, size_t *entry_offset_byte_rtn);
+
+/**
+ * @return whether the entry with sequence number @param seq is still stored in @param ring.
+ * Readers which dereference an entry's buffptr call this afterwards, and discard what
+ * they read if the entry has been overwritten meanwhile.
+ */
+static inline bool aesd_circular_buffer_spmc_valid(struct aesd_circular_buffer_spmc *ring,
+            uint64_t seq)
+{
+    // Order the reader's loads from buffptr before the check
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&ring->head, memory_order_relaxed) - seq <= ring->capacity;
+}
+
+/**
+ * @return the stream position following the newest entry of @param ring
+ */
+static inline size_t aesd_circular_buffer_spmc_end(struct aesd_circular_buffer_spmc *ring)
+{
+    return atomic_load_explicit(&ring->head_offs, memory_order_acquire);
+}
+
+#endif /* AESD_CIRCULAR_BUFFER_SPMC_H */
@@ -12,10 +12,126 @@
 #include <linux/string.h>
 #else
 #include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_OFFS_INDEX_X86 1
+#endif
 #endif
 
 #include "aesd-circular-buffer.h"
 
+/**
+ * @return the entry @param index positions after the oldest one, without bounds checking
+ */
+static inline struct aesd_buffer_entry *entry_at(struct aesd_circular_buffer *buffer,
+            uint32_t index)
+{
+    uint32_t slot = buffer->out_offs + index;
+
+    if (slot >= buffer->capacity)
+        slot -= buffer->capacity;
+    return &buffer->entry[slot];
+}
+
+#ifndef __KERNEL__
+/**
+ * Sorted runs of the offs index at most this long are scanned instead of bisected
+ */
+#define OFFS_INDEX_SCAN 32
+
+#if HAVE_OFFS_INDEX_X86
+/*
+ * The vector scans are built for their own instruction set whatever the compiler
+ * flags, and chosen at run time from what the CPU supports.  Compares are signed,
+ * stream positions stay far below 2^63.
+ */
+__attribute__((target("avx2")))
+static uint32_t offs_index_scan_avx2(const size_t *offs, uint32_t n, size_t target, uint32_t *i)
+{
+    __m256i t = _mm256_set1_epi64x((long long)target);
+    uint32_t count = 0;
+
+    for (; *i + 4 <= n; *i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)&offs[*i]);
+        int above = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, t)));
+
+        count += 4 - __builtin_popcount(above);
+    }
+    return count;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t offs_index_scan_sse42(const size_t *offs, uint32_t n, size_t target, uint32_t *i)
+{
+    __m128i t = _mm_set1_epi64x((long long)target);
+    uint32_t count = 0;
+
+    for (; *i + 2 <= n; *i += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&offs[*i]);
+        int above = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(v, t)));
+
+        count += 2 - __builtin_popcount(above);
+    }
+    return count;
+}
+#endif
+
+/**
+ * @return the number of elements of @param offs, @param n sorted values, which are
+ * at most @param target
+ */
+static uint32_t offs_index_count_le(const size_t *offs, uint32_t n, size_t target)
+{
+    uint32_t lo = 0;
+    uint32_t i = 0;
+    uint32_t count;
+
+    // Everything before lo is at most target, everything from lo + n on is above it
+    while (n > OFFS_INDEX_SCAN) {
+        uint32_t half = n / 2;
+
+        if (offs[lo + half] <= target) {
+            lo += half + 1;
+            n -= half + 1;
+        } else {
+            n = half;
+        }
+    }
+
+    offs += lo;
+    count = lo;
+#if HAVE_OFFS_INDEX_X86
+    if (__builtin_cpu_supports("avx2"))
+        count += offs_index_scan_avx2(offs, n, target, &i);
+    else if (__builtin_cpu_supports("sse4.2"))
+        count += offs_index_scan_sse42(offs, n, target, &i);
+#endif
+    for (; i < n; i++)
+        count += offs[i] <= target;
+    return count;
+}
+
+/**
+ * @return the slot of the newest entry starting at or before stream position
+ * @param target, which must be within the buffer, found through buffer->offs_index
+ */
+static uint32_t offs_index_find(const struct aesd_circular_buffer *buffer, size_t target)
+{
+    const size_t *offs = buffer->offs_index;
+    uint32_t count = aesd_circular_buffer_count(buffer);
+
+    // Unwrapped, the entries are one sorted run from out_offs
+    if (buffer->out_offs + count <= buffer->capacity)
+        return buffer->out_offs + offs_index_count_le(offs + buffer->out_offs, count, target) - 1;
+
+    // Wrapped, slot 0 holds the first entry of the newer run
+    if (offs[0] <= target)
+        return offs_index_count_le(offs, buffer->in_offs, target) - 1;
+    return buffer->out_offs +
+        offs_index_count_le(offs + buffer->out_offs, buffer->capacity - buffer->out_offs, target) - 1;
+}
+#endif
+
 /**
  * @param buffer the buffer to search for corresponding offset.  Any necessary locking must be performed by caller.
  * @param char_offset the position to search for in the buffer list, describing the zero referenced
@@ -29,22 +145,64 @@
 struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn )
 {
-    size_t trav = buffer->out_offs;
-    size_t count = buffer->entry[trav].size;
-    if(char_offset <= count-1){
-        *entry_offset_byte_rtn = buffer->entry[trav].size-(count-char_offset);
-        return &buffer->entry[trav];
+    uint32_t lo = 0;
+    uint32_t hi = aesd_circular_buffer_count(buffer);
+    struct aesd_buffer_entry *entry;
+    size_t base;
+
+    if (hi == 0)
+        return NULL;
+
+    base = buffer->entry[buffer->out_offs].offs;
+    if (char_offset >= buffer->head_offs - base)
+        return NULL;
+
+#ifndef __KERNEL__
+    if (buffer->offs_index) {
+        entry = &buffer->entry[offs_index_find(buffer, base + char_offset)];
+        *entry_offset_byte_rtn = char_offset - (entry->offs - base);
+        return entry;
     }
-    trav = (trav+1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-    while(trav != buffer->out_offs){
-        count += buffer->entry[trav].size;
-        if(char_offset <= count-1){
-            *entry_offset_byte_rtn = buffer->entry[trav].size-(count-char_offset);
-            return &buffer->entry[trav];
-        }
-        trav = (trav+1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+#endif
+
+    // Find the newest entry starting at or before char_offset
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (entry_at(buffer, mid)->offs - base <= char_offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    entry = entry_at(buffer, lo);
+    *entry_offset_byte_rtn = char_offset - (entry->offs - base);
+    return entry;
+}
+
+/**
+ * @param buffer the buffer to search, holding entries added in non-decreasing timestamp order.
+ *      Any necessary locking must be performed by caller.
+ * @return the oldest entry whose timestamp is at or after @param timestamp, or NULL if all
+ * entries are older
+ */
+struct aesd_buffer_entry *aesd_circular_buffer_find_entry_for_time(struct aesd_circular_buffer *buffer,
+            uint64_t timestamp)
+{
+    uint32_t count = aesd_circular_buffer_count(buffer);
+    uint32_t lo = 0;
+    uint32_t hi = count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (entry_at(buffer, mid)->timestamp < timestamp)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    return NULL;
+
+    return lo < count ? entry_at(buffer, lo) : NULL;
 }
 
 /**
@@ -62,20 +220,141 @@ const struct aesd_buffer_entry *aesd_circular_buffer_add_entry(
 
     if (buffer->full) {
         ret = &buffer->entry[buffer->in_offs];
-        buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        buffer->out_offs = (buffer->out_offs + 1) % buffer->capacity;
     }
 
     buffer->entry[buffer->in_offs] = *add_entry;
-    buffer->in_offs = (buffer->in_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    buffer->entry[buffer->in_offs].offs = buffer->head_offs;
+#ifndef __KERNEL__
+    if (buffer->offs_index)
+        buffer->offs_index[buffer->in_offs] = buffer->head_offs;
+#endif
+    buffer->head_offs += add_entry->size;
+    buffer->in_offs = (buffer->in_offs + 1) % buffer->capacity;
     buffer->full = (buffer->in_offs == buffer->out_offs);
 
     return ret;
 }
 
+/**
+* @return the number of entries currently stored in @param buffer
+*/
+uint32_t aesd_circular_buffer_count(const struct aesd_circular_buffer *buffer)
+{
+    if (buffer->full)
+        return buffer->capacity;
+    return (buffer->in_offs + buffer->capacity - buffer->out_offs) % buffer->capacity;
+}
+
+/**
+* @return the entry at zero referenced position @param index counting from the oldest entry in
+* @param buffer, or NULL if fewer entries are stored
+*/
+struct aesd_buffer_entry *aesd_circular_buffer_get(struct aesd_circular_buffer *buffer,
+            uint32_t index)
+{
+    if (index >= aesd_circular_buffer_count(buffer))
+        return NULL;
+    return entry_at(buffer, index);
+}
+
+/**
+* @return the number of bytes stored in all entries of @param buffer
+*/
+size_t aesd_circular_buffer_size(const struct aesd_circular_buffer *buffer)
+{
+    if (aesd_circular_buffer_count(buffer) == 0)
+        return 0;
+    return buffer->head_offs - buffer->entry[buffer->out_offs].offs;
+}
+
+/**
+* Removes the oldest entry from @param buffer.
+* Any necessary locking must be handled by the caller
+* @return the removed entry so the caller can release the memory it references, or NULL if
+* the buffer is empty.  The returned slot is reused by the next aesd_circular_buffer_add_entry()
+*/
+struct aesd_buffer_entry *aesd_circular_buffer_remove_oldest(struct aesd_circular_buffer *buffer)
+{
+    struct aesd_buffer_entry *ret;
+
+    if (!buffer->full && buffer->in_offs == buffer->out_offs)
+        return NULL;
+
+    ret = &buffer->entry[buffer->out_offs];
+    buffer->out_offs = (buffer->out_offs + 1) % buffer->capacity;
+    buffer->full = false;
+    return ret;
+}
+
+/**
+* Moves the entries of @param buffer, oldest first, into @param storage which holds
+* @param capacity entries, and uses it as the buffer's storage from now on.
+* The caller must first remove entries which would not fit, and is responsible for
+* releasing the previous storage.
+* Any necessary locking must be handled by the caller
+*/
+void aesd_circular_buffer_migrate(struct aesd_circular_buffer *buffer,
+            struct aesd_buffer_entry *storage, uint32_t capacity)
+{
+    uint32_t count = aesd_circular_buffer_count(buffer);
+    uint32_t i;
+
+    for (i = 0; i < count; i++)
+        storage[i] = buffer->entry[(buffer->out_offs + i) % buffer->capacity];
+    for (; i < capacity; i++)
+        memset(&storage[i], 0, sizeof(storage[i]));
+
+    buffer->entry = storage;
+    buffer->capacity = capacity;
+    buffer->out_offs = 0;
+    buffer->in_offs = count % capacity;
+    buffer->full = (count == capacity);
+#ifndef __KERNEL__
+    buffer->offs_index = NULL;
+#endif
+}
+
+#ifndef __KERNEL__
 /**
 * Initializes the circular buffer described by @param buffer to an empty struct
+* holding up to AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries
 */
 void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer)
 {
     memset(buffer,0,sizeof(struct aesd_circular_buffer));
+    buffer->entry = buffer->inline_entry;
+    buffer->capacity = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
+/**
+* Attaches @param index, an array of @param buffer->capacity elements, as the dense copy
+* of each slot's offs searched by fpos lookups, or detaches the index if NULL.
+* See aesd-circular-buffer.h
+*/
+void aesd_circular_buffer_set_offs_index(struct aesd_circular_buffer *buffer,
+            size_t *index)
+{
+    uint32_t i;
+
+    buffer->offs_index = index;
+    if (index == NULL)
+        return;
+    for (i = 0; i < buffer->capacity; i++)
+        index[i] = buffer->entry[i].offs;
+}
+#endif
+
+/**
+* Initializes the circular buffer described by @param buffer to an empty struct
+* which stores up to @param capacity entries in @param storage.
+* The lifetime of @param storage is managed by the caller
+*/
+void aesd_circular_buffer_init_storage(struct aesd_circular_buffer *buffer,
+            struct aesd_buffer_entry *storage, uint32_t capacity)
+{
+    memset(buffer,0,sizeof(struct aesd_circular_buffer));
+    memset(storage,0,sizeof(*storage) * capacity);
+    buffer->entry = storage;
+    buffer->capacity = capacity;
 }
@@ -16,6 +16,10 @@
 #include <stdbool.h>
 #endif
 
+/**
+ * Capacity of a buffer set up with aesd_circular_buffer_init().  Buffers with
+ * other capacities use caller provided storage, see aesd_circular_buffer_init_storage()
+ */
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
 
 struct aesd_buffer_entry
@@ -28,6 +32,27 @@ struct aesd_buffer_entry
      * Number of bytes stored in buffptr
      */
     size_t size;
+    /**
+     * Position of the first byte of this entry in the stream of all bytes ever
+     * added to the buffer.  Set by aesd_circular_buffer_add_entry()
+     */
+    size_t offs;
+    /**
+     * CRC32C of the bytes in buffptr, set by the owner of the entry and
+     * checked when the entry is read back
+     */
+    uint32_t crc32c;
+    /**
+     * Time the entry was added, in units chosen by its owner.  Entries must be
+     * added in non-decreasing timestamp order to be searched with
+     * aesd_circular_buffer_find_entry_for_time()
+     */
+    uint64_t timestamp;
+    /**
+     * Data owned by the creator of the entry.  The aesdchar driver stores the
+     * struct aesd_record describing the entry's bytes here instead of using buffptr
+     */
+    void *priv;
 };
 
 struct aesd_circular_buffer
@@ -35,37 +60,103 @@ struct aesd_circular_buffer
     /**
      * An array of pointers to memory allocated for the most recent write operations
      */
-    struct aesd_buffer_entry  entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    struct aesd_buffer_entry  *entry;
+    /**
+     * The number of elements in entry
+     */
+    uint32_t capacity;
     /**
      * The current location in the entry structure where the next write should
      * be stored.
      */
-    uint8_t in_offs;
+    uint32_t in_offs;
     /**
      * The first location in the entry structure to read from
      */
-    uint8_t out_offs;
+    uint32_t out_offs;
     /**
      * set to true when the buffer entry structure is full
      */
     bool full;
+    /**
+     * Stream position at which the next added entry will start, see aesd_buffer_entry.offs.
+     * Entries are located relative to the offs of the oldest entry, so positions stay
+     * valid across eviction without rewriting the remaining entries.
+     */
+    size_t head_offs;
+#ifndef __KERNEL__
+    /**
+     * Optional dense copy of entry[i].offs, see aesd_circular_buffer_set_offs_index().
+     * NULL when fpos lookups search entry directly.
+     */
+    size_t *offs_index;
+    /**
+     * Storage used for entry by aesd_circular_buffer_init().  The driver always
+     * provides its own storage, and keeps the struct small enough to snapshot.
+     */
+    struct aesd_buffer_entry  inline_entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+#endif
 };
 
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn );
 
+extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_for_time(struct aesd_circular_buffer *buffer,
+            uint64_t timestamp);
+
 extern const struct aesd_buffer_entry *aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry);
 
+#ifndef __KERNEL__
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
+/**
+ * Structure-of-arrays layout for fpos lookups in user space builds.  An entry
+ * fills most of a cache line, so a binary search over entry touches a line per
+ * step for the one offs it compares.  With an index attached the buffer also
+ * keeps each slot's offs in @param index, an array of buffer->capacity elements
+ * owned by the caller, and lookups search that dense array instead, finishing
+ * with an SSE4.2 or AVX2 scan on x86_64 CPUs which support either.
+ * Attaching fills the index from the entries already stored, NULL detaches it.
+ * aesd_circular_buffer_migrate() detaches the index, attach one sized for the
+ * new capacity afterwards.
+ */
+extern void aesd_circular_buffer_set_offs_index(struct aesd_circular_buffer *buffer,
+            size_t *index);
+#endif
+
+extern void aesd_circular_buffer_init_storage(struct aesd_circular_buffer *buffer,
+            struct aesd_buffer_entry *storage, uint32_t capacity);
+
+extern uint32_t aesd_circular_buffer_count(const struct aesd_circular_buffer *buffer);
+
+extern struct aesd_buffer_entry *aesd_circular_buffer_remove_oldest(struct aesd_circular_buffer *buffer);
+
+extern struct aesd_buffer_entry *aesd_circular_buffer_get(struct aesd_circular_buffer *buffer,
+            uint32_t index);
+
+extern size_t aesd_circular_buffer_size(const struct aesd_circular_buffer *buffer);
+
+/**
+ * @return the zero referenced character index of the first byte of @param entry, an entry
+ * currently stored in @param buffer, if all buffer strings were concatenated end to end
+ */
+static inline size_t aesd_circular_buffer_entry_fpos(const struct aesd_circular_buffer *buffer,
+            const struct aesd_buffer_entry *entry)
+{
+    return entry->offs - buffer->entry[buffer->out_offs].offs;
+}
+
+extern void aesd_circular_buffer_migrate(struct aesd_circular_buffer *buffer,
+            struct aesd_buffer_entry *storage, uint32_t capacity);
+
 /**
  * Create a for loop to iterate over each member of the circular buffer.
  * Useful when you've allocated memory for circular buffer entries and need to free it
  * @param entryptr is a struct aesd_buffer_entry* to set with the current entry
  * @param buffer is the struct aesd_buffer * describing the buffer
- * @param index is a uint8_t stack allocated value used by this macro for an index
+ * @param index is a uint32_t stack allocated value used by this macro for an index
  * Example usage:
- * uint8_t index;
+ * uint32_t index;
  * struct aesd_circular_buffer buffer;
  * struct aesd_buffer_entry *entry;
  * AESD_CIRCULAR_BUFFER_FOREACH(entry,&buffer,index) {
@@ -74,7 +165,7 @@ extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
  */
 #define AESD_CIRCULAR_BUFFER_FOREACH(entryptr,buffer,index) \
     for(index=0, entryptr=&((buffer)->entry[index]); \
-            index<AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; \
+            index<(buffer)->capacity; \
             index++, entryptr=&((buffer)->entry[index]))
 
 
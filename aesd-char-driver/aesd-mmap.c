@@ -0,0 +1,189 @@
+/**
+ * @file aesd-mmap.c
+ * @brief Page backed copy of the aesdchar records for read-only mmap
+ *
+ * See aesd-mmap.h for an overview and aesd_ioctl.h for the layout seen by
+ * user space.  All functions except aesd_mmap_map() are called with the
+ * device lock held.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/math64.h>
+#include <linux/version.h>
+#include "aesd-mmap.h"
+#include "aesd-record.h"
+#include "aesd_ioctl.h"
+
+/*
+ * The header seq is odd between these, readers retry until it is even and
+ * unchanged across their copy of the header
+ */
+static void aesd_mmap_begin(struct aesd_mmap_header *hdr)
+{
+    WRITE_ONCE(hdr->seq, hdr->seq + 1);
+    smp_wmb();
+}
+
+static void aesd_mmap_end(struct aesd_mmap_header *hdr)
+{
+    smp_wmb();
+    WRITE_ONCE(hdr->seq, hdr->seq + 1);
+}
+
+static struct aesd_mmap_record *aesd_mmap_slot(struct aesd_mmap_header *hdr, u64 seq)
+{
+    u32 slot;
+
+    div_u64_rem(seq, hdr->nr_slots, &slot);
+    return &hdr->record[slot];
+}
+
+/*
+ * Stop describing records which are no longer in the ring, no longer have a
+ * slot, or whose bytes were overwritten in the data area
+ */
+static void aesd_mmap_advance_first(struct aesd_mmap_header *hdr, u64 oldest_seq)
+{
+    u64 first = max(hdr->first_seq, oldest_seq);
+
+    if (hdr->write_seq - first > hdr->nr_slots)
+        first = hdr->write_seq - hdr->nr_slots;
+    while (first < hdr->write_seq &&
+           aesd_mmap_slot(hdr, first)->offs + hdr->data_size < hdr->head_offs)
+        first++;
+    WRITE_ONCE(hdr->first_seq, first);
+}
+
+/**
+ * @return an area with room for @data_size bytes of records, a multiple of
+ * PAGE_SIZE, describing no records and expecting record @first_seq starting
+ * at stream position @head_offs next, or NULL
+ */
+struct aesd_mmap_area *aesd_mmap_area_create(size_t data_size, u64 first_seq,
+                                             size_t head_offs)
+{
+    unsigned long data_pages = data_size >> PAGE_SHIFT;
+    struct aesd_mmap_header *hdr;
+    struct aesd_mmap_area *area;
+    unsigned long i;
+
+    area = kzalloc(sizeof(*area), GFP_KERNEL);
+    if (!area)
+        return NULL;
+
+    area->nr_pages = 1 + 2 * data_pages;
+    area->pages = kvcalloc(area->nr_pages, sizeof(*area->pages), GFP_KERNEL);
+    if (!area->pages)
+        goto fail;
+
+    for (i = 0; i < 1 + data_pages; i++) {
+        area->pages[i] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+        if (!area->pages[i])
+            goto fail;
+    }
+    for (i = 0; i < data_pages; i++)
+        area->pages[1 + data_pages + i] = area->pages[1 + i];
+
+    hdr = vmap(area->pages, area->nr_pages, VM_MAP, PAGE_KERNEL);
+    if (!hdr)
+        goto fail;
+
+    area->hdr = hdr;
+    area->data = (char *)hdr + PAGE_SIZE;
+    hdr->magic = AESD_MMAP_MAGIC;
+    hdr->version = AESD_MMAP_VERSION;
+    hdr->nr_slots = (PAGE_SIZE - sizeof(*hdr)) / sizeof(hdr->record[0]);
+    hdr->data_size = data_size;
+    hdr->head_offs = head_offs;
+    hdr->first_seq = first_seq;
+    hdr->write_seq = first_seq;
+    return area;
+
+fail:
+    aesd_mmap_area_destroy(area);
+    return NULL;
+}
+
+void aesd_mmap_area_destroy(struct aesd_mmap_area *area)
+{
+    unsigned long i;
+
+    if (!area)
+        return;
+
+    if (area->hdr)
+        vunmap(area->hdr);
+    if (area->pages) {
+        // The second half repeats the data pages
+        for (i = 0; i < area->nr_pages / 2 + 1 && area->pages[i]; i++)
+            __free_page(area->pages[i]);
+        kvfree(area->pages);
+    }
+    kfree(area);
+}
+
+/**
+ * Copy @record, number @seq, starting at stream position @offs, into the data
+ * area and describe it in the header.  @seq must follow the newest record
+ * published, and @oldest_seq is the oldest record still in the ring.
+ */
+void aesd_mmap_publish(struct aesd_mmap_area *area, u64 seq, size_t offs,
+                       const struct aesd_record *record, u32 crc, u64 oldest_seq)
+{
+    struct aesd_mmap_header *hdr = area->hdr;
+    struct aesd_mmap_record *slot;
+    u32 pos;
+
+    aesd_mmap_begin(hdr);
+
+    // Readers checking bytes read in place must see the new head first
+    WRITE_ONCE(hdr->head_offs, offs + record->size);
+    smp_wmb();
+
+    if (record->size <= hdr->data_size) {
+        unsigned int i;
+
+        div_u64_rem(offs, (u32)hdr->data_size, &pos);
+        for (i = 0; i < record->nr_segs; i++)
+            memcpy(area->data + pos + record->segs[i].offs, record->segs[i].ptr,
+                   record->segs[i].len);
+    }
+
+    slot = aesd_mmap_slot(hdr, seq);
+    slot->offs = offs;
+    slot->size = record->size;
+    slot->crc32c = crc;
+    WRITE_ONCE(hdr->write_seq, seq + 1);
+    aesd_mmap_advance_first(hdr, oldest_seq);
+
+    aesd_mmap_end(hdr);
+}
+
+/**
+ * Stop describing records older than @oldest_seq, after they were evicted from the ring
+ */
+void aesd_mmap_trim(struct aesd_mmap_area *area, u64 oldest_seq)
+{
+    aesd_mmap_begin(area->hdr);
+    aesd_mmap_advance_first(area->hdr, oldest_seq);
+    aesd_mmap_end(area->hdr);
+}
+
+/**
+ * Map the header and data pages into @vma, which may not be writable
+ */
+int aesd_mmap_map(struct aesd_mmap_area *area, struct vm_area_struct *vma)
+{
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+    return vm_map_pages(vma, area->pages, area->nr_pages);
+}
@@ -0,0 +1,44 @@
+/*
+ * aesd-mmap.h
+ *
+ *  @brief Page backed copy of the aesdchar records for read-only mmap
+ *
+ *  Created on the first mmap of the device.  From then on every committed
+ *  record is also copied into a data area laid out by stream offset, and
+ *  described in a metadata page, see struct aesd_mmap_header in aesd_ioctl.h.
+ *  The data pages are mapped twice in a row, in the kernel as in user space,
+ *  so records which wrap around the end of the area stay contiguous.
+ */
+
+#ifndef AESD_CHAR_DRIVER_AESD_MMAP_H_
+#define AESD_CHAR_DRIVER_AESD_MMAP_H_
+
+#include <linux/types.h>
+
+struct aesd_record;
+struct page;
+struct vm_area_struct;
+
+struct aesd_mmap_area
+{
+    struct aesd_mmap_header *hdr;
+    /**
+     * hdr->data_size bytes, followed by the same bytes again
+     */
+    char *data;
+    /**
+     * The header page, the data pages, then the data pages again
+     */
+    struct page **pages;
+    unsigned long nr_pages;
+};
+
+extern struct aesd_mmap_area *aesd_mmap_area_create(size_t data_size, u64 first_seq,
+                                                    size_t head_offs);
+extern void aesd_mmap_area_destroy(struct aesd_mmap_area *area);
+extern void aesd_mmap_publish(struct aesd_mmap_area *area, u64 seq, size_t offs,
+                              const struct aesd_record *record, u32 crc, u64 oldest_seq);
+extern void aesd_mmap_trim(struct aesd_mmap_area *area, u64 oldest_seq);
+extern int aesd_mmap_map(struct aesd_mmap_area *area, struct vm_area_struct *vma);
+
+#endif /* AESD_CHAR_DRIVER_AESD_MMAP_H_ */
@@ -0,0 +1,291 @@
+/**
+ * @file aesd-record.c
+ * @brief Slab backed blocks and records for the aesdchar driver
+ *
+ * See aesd-record.h for an overview.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/uio.h>
+#include <linux/crc32c.h>
+#include <linux/err.h>
+#include <linux/uaccess.h>
+#include "aesd-record.h"
+
+/*
+ * Block pools, by total allocation size including struct aesd_block.  The
+ * largest pool is a single page.
+ */
+static const unsigned int aesd_block_pool_size[] = { 128, 512, 2048, PAGE_SIZE };
+static const char * const aesd_block_pool_name[] = {
+    "aesd_block_128", "aesd_block_512", "aesd_block_2048", "aesd_block_page",
+};
+#define AESD_BLOCK_POOLS ARRAY_SIZE(aesd_block_pool_size)
+#define AESD_BLOCK_MAX_DATA (PAGE_SIZE - sizeof(struct aesd_block))
+
+static struct kmem_cache *aesd_block_pool[AESD_BLOCK_POOLS];
+static struct kmem_cache *aesd_record_cache;
+
+int aesd_record_pools_init(void)
+{
+    unsigned int i;
+
+    aesd_record_cache = KMEM_CACHE(aesd_record, SLAB_HWCACHE_ALIGN);
+    if (!aesd_record_cache)
+        return -ENOMEM;
+
+    for (i = 0; i < AESD_BLOCK_POOLS; i++) {
+        aesd_block_pool[i] = kmem_cache_create(aesd_block_pool_name[i],
+                                               aesd_block_pool_size[i], 0, 0, NULL);
+        if (!aesd_block_pool[i]) {
+            aesd_record_pools_destroy();
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+void aesd_record_pools_destroy(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < AESD_BLOCK_POOLS; i++) {
+        kmem_cache_destroy(aesd_block_pool[i]);
+        aesd_block_pool[i] = NULL;
+    }
+    kmem_cache_destroy(aesd_record_cache);
+    aesd_record_cache = NULL;
+}
+
+/**
+ * @return a block holding @size bytes of data, at most AESD_BLOCK_MAX_DATA,
+ * with one reference held by the caller, or NULL
+ */
+struct aesd_block *aesd_block_alloc(size_t size)
+{
+    size_t need = sizeof(struct aesd_block) + size;
+    struct aesd_block *block;
+    unsigned int pool;
+
+    for (pool = 0; pool < AESD_BLOCK_POOLS; pool++) {
+        if (need <= aesd_block_pool_size[pool])
+            break;
+    }
+    if (pool == AESD_BLOCK_POOLS)
+        return NULL;
+
+    block = kmem_cache_alloc(aesd_block_pool[pool], GFP_KERNEL);
+    if (!block)
+        return NULL;
+
+    refcount_set(&block->refs, 1);
+    block->len = size;
+    block->next = NULL;
+    block->pool = pool;
+    return block;
+}
+
+void aesd_block_put(struct aesd_block *block)
+{
+    if (refcount_dec_and_test(&block->refs))
+        kmem_cache_free(aesd_block_pool[block->pool], block);
+}
+
+/**
+ * Copy the @count bytes left in @from into a chain of blocks linked through
+ * next.  The chain is sized for the whole of @from, so a writev of many small
+ * records fills blocks as full as a single write would.  Small writes get a
+ * single block from the smallest pool which fits.
+ * @return the first block, or an ERR_PTR
+ */
+struct aesd_block *aesd_block_chain_from_iter(struct iov_iter *from)
+{
+    struct aesd_block *head = NULL;
+    struct aesd_block **tail = &head;
+    size_t count = iov_iter_count(from);
+    int err;
+
+    while (count) {
+        size_t len = min_t(size_t, count, AESD_BLOCK_MAX_DATA);
+        struct aesd_block *block = aesd_block_alloc(len);
+
+        if (!block) {
+            err = -ENOMEM;
+            goto fail;
+        }
+        *tail = block;
+        tail = &block->next;
+
+        if (copy_from_iter(block->data, len, from) != len) {
+            err = -EFAULT;
+            goto fail;
+        }
+        count -= len;
+    }
+    return head;
+
+fail:
+    aesd_block_chain_put(head);
+    return ERR_PTR(err);
+}
+
+/**
+ * Drop the caller's reference on every block of a chain
+ */
+void aesd_block_chain_put(struct aesd_block *head)
+{
+    while (head) {
+        struct aesd_block *next = head->next;
+
+        aesd_block_put(head);
+        head = next;
+    }
+}
+
+struct aesd_record *aesd_record_alloc(void)
+{
+    struct aesd_record *record = kmem_cache_alloc(aesd_record_cache, GFP_KERNEL);
+
+    if (!record)
+        return NULL;
+
+    refcount_set(&record->refs, 1);
+    record->size = 0;
+    record->nr_segs = 0;
+    record->max_segs = AESD_RECORD_INLINE_SEGS;
+    record->segs = record->inline_segs;
+    record->crc_checked = false;
+    return record;
+}
+
+static void aesd_record_free_rcu(struct rcu_head *head)
+{
+    struct aesd_record *record = container_of(head, struct aesd_record, rcu);
+    unsigned int i;
+
+    for (i = 0; i < record->nr_segs; i++)
+        aesd_block_put(record->segs[i].block);
+    if (record->segs != record->inline_segs)
+        kvfree(record->segs);
+    kmem_cache_free(aesd_record_cache, record);
+}
+
+/**
+ * Drop a reference on @record, freeing it after an RCU grace period once the
+ * last one is gone.  Callers of aesd_record_pools_destroy() must rcu_barrier() first.
+ */
+void aesd_record_put(struct aesd_record *record)
+{
+    if (record && refcount_dec_and_test(&record->refs))
+        call_rcu(&record->rcu, aesd_record_free_rcu);
+}
+
+/**
+ * Add @len bytes at @ptr, which lie inside @block, to the end of @record.
+ * The record takes its own reference on @block.
+ */
+int aesd_record_append(struct aesd_record *record, struct aesd_block *block,
+                       const char *ptr, size_t len)
+{
+    struct aesd_seg *last = record->nr_segs ? &record->segs[record->nr_segs - 1] : NULL;
+
+    if (!len)
+        return 0;
+
+    if (last && last->block == block && last->ptr + last->len == ptr) {
+        last->len += len;
+        record->size += len;
+        return 0;
+    }
+
+    if (record->nr_segs == record->max_segs) {
+        unsigned int max_segs = record->max_segs * 2;
+        struct aesd_seg *segs = kvmalloc_array(max_segs, sizeof(*segs), GFP_KERNEL);
+
+        if (!segs)
+            return -ENOMEM;
+        memcpy(segs, record->segs, record->nr_segs * sizeof(*segs));
+        if (record->segs != record->inline_segs)
+            kvfree(record->segs);
+        record->segs = segs;
+        record->max_segs = max_segs;
+    }
+
+    refcount_inc(&block->refs);
+    record->segs[record->nr_segs].block = block;
+    record->segs[record->nr_segs].ptr = ptr;
+    record->segs[record->nr_segs].len = len;
+    record->segs[record->nr_segs].offs = record->size;
+    record->nr_segs++;
+    record->size += len;
+    return 0;
+}
+
+/**
+ * Append the bytes of @src to @record, referencing the same blocks
+ */
+int aesd_record_append_record(struct aesd_record *record, const struct aesd_record *src)
+{
+    unsigned int i;
+
+    for (i = 0; i < src->nr_segs; i++) {
+        int err = aesd_record_append(record, src->segs[i].block, src->segs[i].ptr,
+                                     src->segs[i].len);
+
+        if (err)
+            return err;
+    }
+    return 0;
+}
+
+/**
+ * @return the standard CRC32C (inverted seed and result) of the bytes in
+ * @record, so values match user space tools
+ */
+u32 aesd_record_crc(const struct aesd_record *record)
+{
+    u32 crc = ~0;
+    unsigned int i;
+
+    for (i = 0; i < record->nr_segs; i++)
+        crc = crc32c(crc, record->segs[i].ptr, record->segs[i].len);
+    return ~crc;
+}
+
+/**
+ * Copy the bytes of @record starting at @offset into @to, until either runs out.
+ * @return the number of bytes copied, short of the requested amount if @to faulted
+ */
+size_t aesd_record_copy_to_iter(const struct aesd_record *record, size_t offset,
+                                struct iov_iter *to)
+{
+    unsigned int lo = 0, hi = record->nr_segs;
+    size_t copied = 0;
+
+    if (offset >= record->size)
+        return 0;
+
+    // Find the last segment starting at or before offset
+    while (hi - lo > 1) {
+        unsigned int mid = lo + (hi - lo) / 2;
+
+        if (record->segs[mid].offs <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    offset -= record->segs[lo].offs;
+
+    for (; lo < record->nr_segs && iov_iter_count(to); lo++) {
+        const struct aesd_seg *seg = &record->segs[lo];
+        size_t n = copy_to_iter(seg->ptr + offset, seg->len - offset, to);
+
+        copied += n;
+        if (n < seg->len - offset)
+            break;
+        offset = 0;
+    }
+    return copied;
+}
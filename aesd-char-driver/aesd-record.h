@@ -0,0 +1,109 @@
+/*
+ * aesd-record.h
+ *
+ *  @brief Storage for the records kept by the aesdchar driver
+ *
+ *  Each write is copied from user space once, into an aesd_block taken from a
+ *  size classed pool.  Records describe their bytes as segments of blocks, so
+ *  the records completed by one write share its block without further copies
+ *  and a record assembled from several writes references each of them.
+ *
+ *  Blocks are at most a page, larger writes are copied into a chain of
+ *  blocks, so neither huge writes nor huge records need high order
+ *  allocations.
+ *
+ *  Committed records are immutable and reference counted.  Readers find them
+ *  without the device lock, so the last reference is dropped through RCU: a
+ *  record evicted while a reader is still looking at the ring stays valid
+ *  until that reader leaves its RCU read side section.
+ */
+
+#ifndef AESD_CHAR_DRIVER_AESD_RECORD_H_
+#define AESD_CHAR_DRIVER_AESD_RECORD_H_
+
+#include <linux/types.h>
+#include <linux/refcount.h>
+#include <linux/rcupdate.h>
+
+struct iov_iter;
+
+/**
+ * Bytes received by one write, shared by every record referencing them
+ */
+struct aesd_block
+{
+    refcount_t refs;
+    /**
+     * Number of bytes used in data
+     */
+    u32 len;
+    /**
+     * The next block of the same write, while the write is being processed
+     */
+    struct aesd_block *next;
+    /**
+     * Index of the pool the block was allocated from
+     */
+    u8 pool;
+    char data[];
+};
+
+/**
+ * A contiguous part of a record
+ */
+struct aesd_seg
+{
+    struct aesd_block *block;
+    const char *ptr;
+    size_t len;
+    /**
+     * Offset of ptr[0] within the record
+     */
+    size_t offs;
+};
+
+#define AESD_RECORD_INLINE_SEGS 2
+
+struct aesd_record
+{
+    /**
+     * One reference is held by the ring entry, others by readers copying out
+     */
+    refcount_t refs;
+    /**
+     * Total number of bytes in all segments
+     */
+    size_t size;
+    unsigned int nr_segs;
+    unsigned int max_segs;
+    /**
+     * Points at inline_segs until a record needs more than AESD_RECORD_INLINE_SEGS,
+     * then at a kvmalloc'd array
+     */
+    struct aesd_seg *segs;
+    /**
+     * Set once the checksum stored with the record has been verified
+     */
+    bool crc_checked;
+    struct rcu_head rcu;
+    struct aesd_seg inline_segs[AESD_RECORD_INLINE_SEGS];
+};
+
+extern int aesd_record_pools_init(void);
+extern void aesd_record_pools_destroy(void);
+
+extern struct aesd_block *aesd_block_alloc(size_t size);
+extern void aesd_block_put(struct aesd_block *block);
+extern struct aesd_block *aesd_block_chain_from_iter(struct iov_iter *from);
+extern void aesd_block_chain_put(struct aesd_block *head);
+
+extern struct aesd_record *aesd_record_alloc(void);
+extern void aesd_record_put(struct aesd_record *record);
+extern int aesd_record_append(struct aesd_record *record, struct aesd_block *block,
+                              const char *ptr, size_t len);
+extern int aesd_record_append_record(struct aesd_record *record, const struct aesd_record *src);
+extern u32 aesd_record_crc(const struct aesd_record *record);
+extern size_t aesd_record_copy_to_iter(const struct aesd_record *record, size_t offset,
+                                       struct iov_iter *to);
+
+#endif /* AESD_CHAR_DRIVER_AESD_RECORD_H_ */
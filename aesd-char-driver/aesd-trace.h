@@ -0,0 +1,116 @@
+/*
+ * aesd-trace.h
+ *
+ *  @brief Tracepoints of the aesdchar driver
+ *
+ *  Enable them under /sys/kernel/tracing/events/aesdchar, or with
+ *  perf record -e 'aesdchar:*'.  Every event carries the minor number of the
+ *  device, so sharded devices can be told apart.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM aesdchar
+
+#if !defined(AESD_CHAR_DRIVER_AESD_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define AESD_CHAR_DRIVER_AESD_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(aesdchar_read,
+    TP_PROTO(unsigned int minor, loff_t pos, size_t count, ssize_t ret),
+    TP_ARGS(minor, pos, count, ret),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(loff_t, pos)
+        __field(size_t, count)
+        __field(ssize_t, ret)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->pos = pos;
+        __entry->count = count;
+        __entry->ret = ret;
+    ),
+    TP_printk("minor=%u pos=%lld count=%zu ret=%zd",
+              __entry->minor, __entry->pos, __entry->count, __entry->ret)
+);
+
+TRACE_EVENT(aesdchar_write,
+    TP_PROTO(unsigned int minor, size_t count, ssize_t ret, unsigned int records),
+    TP_ARGS(minor, count, ret, records),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(size_t, count)
+        __field(ssize_t, ret)
+        __field(unsigned int, records)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->count = count;
+        __entry->ret = ret;
+        __entry->records = records;
+    ),
+    TP_printk("minor=%u count=%zu ret=%zd records=%u",
+              __entry->minor, __entry->count, __entry->ret, __entry->records)
+);
+
+TRACE_EVENT(aesdchar_ioctl,
+    TP_PROTO(unsigned int minor, unsigned int cmd, long ret),
+    TP_ARGS(minor, cmd, ret),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(unsigned int, cmd)
+        __field(long, ret)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->cmd = cmd;
+        __entry->ret = ret;
+    ),
+    TP_printk("minor=%u cmd=%#x ret=%ld", __entry->minor, __entry->cmd, __entry->ret)
+);
+
+/*
+ * An entry left the ring, because it was full, over its byte budget or resized
+ */
+TRACE_EVENT(aesdchar_evict,
+    TP_PROTO(unsigned int minor, size_t offs, size_t size),
+    TP_ARGS(minor, offs, size),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(size_t, offs)
+        __field(size_t, size)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->offs = offs;
+        __entry->size = size;
+    ),
+    TP_printk("minor=%u offs=%zu size=%zu", __entry->minor, __entry->offs, __entry->size)
+);
+
+/*
+ * dev->lock was contended, and taking it took @wait_ns
+ */
+TRACE_EVENT(aesdchar_lock_wait,
+    TP_PROTO(unsigned int minor, u64 wait_ns),
+    TP_ARGS(minor, wait_ns),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(u64, wait_ns)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->wait_ns = wait_ns;
+    ),
+    TP_printk("minor=%u wait_ns=%llu", __entry->minor, __entry->wait_ns)
+);
+
+#endif /* AESD_CHAR_DRIVER_AESD_TRACE_H_ */
+
+/* This part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE aesd-trace
+#include <trace/define_trace.h>
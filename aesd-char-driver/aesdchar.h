@@ -7,9 +7,14 @@
 
 #ifndef AESD_CHAR_DRIVER_AESDCHAR_H_
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
+#include <linux/seqlock.h>
+#include <linux/wait.h>
+#include <linux/atomic.h>
 #include "aesd-circular-buffer.h"
+#include "aesd-record.h"
+#include "aesd-mmap.h"
 
-#define AESD_DEBUG 1  //Remove comment on this line to enable debug
+//#define AESD_DEBUG 1  //Remove comment on this line to enable debug
 
 #undef PDEBUG             /* undef it, just in case */
 #ifdef AESD_DEBUG
@@ -24,12 +29,112 @@
 #  define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
 
+/**
+ * Counters of one device, read through sysfs.  Updated without dev->lock,
+ * since readers never take it.
+ */
+struct aesd_stats
+{
+    /**
+     * Bytes accepted by write and returned by read
+     */
+    atomic64_t bytes_in;
+    atomic64_t bytes_out;
+    /**
+     * Entries dropped to make room, or by shrinking the ring or byte budget
+     */
+    atomic64_t evictions;
+    /**
+     * Total time spent waiting for a contended dev->lock
+     */
+    atomic64_t lock_wait_ns;
+    /**
+     * Operations failed for lack of memory
+     */
+    atomic64_t enomem;
+};
+
 struct aesd_dev
 {
     struct cdev cdev;
+    /**
+     * Minor number offset of the device, N in /dev/aesdcharN
+     */
+    unsigned int index;
+    /**
+     * The class device holding the sysfs attributes
+     */
+    struct device *device;
     struct aesd_circular_buffer circbuf;
-    struct aesd_buffer_entry working;
+    /**
+     * Unterminated command left by files released in the middle of one,
+     * continued by the next write starting a command on any file
+     */
+    struct aesd_record *orphan;
+    /**
+     * Number of records committed since the module was loaded
+     */
+    u64 write_seq;
+    /**
+     * Timestamp of the newest record, timestamps of later ones never go below it
+     */
+    u64 last_time_ns;
+    /**
+     * Oldest entries are evicted to keep the bytes stored within this limit,
+     * 0 for none.  Commands still being written, in a file's working record or
+     * the orphan, are held to it too: writes which would take one past the
+     * limit fail with EFBIG.  A record larger than the limit, left by lowering
+     * it, is kept alone.  Set through the max_bytes sysfs attribute
+     */
+    size_t max_bytes;
+    struct aesd_stats stats;
+    /**
+     * Copy of the records for mmap, created by the first mmap of the device
+     */
+    struct aesd_mmap_area *mmap;
+    /**
+     * Serializes commits, resize, the orphan record and the mmap area.
+     * Readers do not take it
+     */
     struct mutex lock;
+    /**
+     * Bumped around every change to circbuf, so lockless readers can detect a
+     * concurrent update and retry.  Entry storage replaced by a resize is freed
+     * after an RCU grace period.
+     */
+    seqcount_mutex_t seq;
+    /**
+     * Woken when a write completes a record, for following readers and poll
+     */
+    wait_queue_head_t wq;
+};
+
+/**
+ * State of one open file, stored in filp->private_data
+ */
+struct aesd_file
+{
+    struct aesd_dev *dev;
+    /**
+     * Stream position following the last byte returned by read, or the target
+     * of the last seek.  Unlike f_pos it does not shift when old entries are
+     * evicted, so a following reader resumes exactly where it stopped.
+     */
+    size_t stream_pos;
+    /**
+     * Set by AESDCHAR_IOCFOLLOW
+     */
+    bool follow;
+    /**
+     * The command being assembled from writes to this file which did not end
+     * in '\n' yet, so concurrent writers on other files cannot interleave
+     * with it
+     */
+    struct aesd_record *working;
+    /**
+     * Serializes writes through this file, taken before dev->lock
+     */
+    struct mutex write_lock;
 };
 
 
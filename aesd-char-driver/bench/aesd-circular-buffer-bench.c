@@ -0,0 +1,179 @@
+/**
+ * @file aesd-circular-buffer-bench.c
+ * @brief ns/op of aesd-circular-buffer.c operations across ring sizes and access patterns
+ *
+ * Measures aesd_circular_buffer_add_entry() on a full ring, where every add
+ * overwrites the oldest entry, and aesd_circular_buffer_find_entry_offset_for_fpos()
+ * with three patterns:
+ * - seq: every position in order, as a reader streaming the ring does
+ * - random: uniformly random positions
+ * - wrap: positions in the entries next to the end of the storage array, where
+ *   the oldest-relative index wraps back to slot 0
+ * The linear scan is the lookup used before entries carried their stream offsets,
+ * it re-sums entry sizes from the oldest entry on every call, and is shown for
+ * random positions as a baseline.  The index column repeats the random lookups
+ * with an offs index attached, see aesd_circular_buffer_set_offs_index().
+ *
+ * Correctness is checked by aesd-circular-buffer-proptest.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../aesd-circular-buffer.h"
+
+#define LOOKUPS 200000
+#define ADDS 2000000
+// Entries on each side of the end of the storage array used by the wrap pattern
+#define WRAP_SPAN 4
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static struct aesd_buffer_entry *scan_find(struct aesd_circular_buffer *buffer,
+            size_t char_offset, size_t *entry_offset_byte_rtn)
+{
+    uint32_t remaining = aesd_circular_buffer_count(buffer);
+    uint32_t trav = buffer->out_offs;
+    size_t count = 0;
+
+    while (remaining--) {
+        count += buffer->entry[trav].size;
+        if (char_offset < count) {
+            *entry_offset_byte_rtn = buffer->entry[trav].size - (count - char_offset);
+            return &buffer->entry[trav];
+        }
+        trav = (trav + 1) % buffer->capacity;
+    }
+    return NULL;
+}
+
+static void fill(struct aesd_circular_buffer *buffer, uint32_t capacity)
+{
+    static const char payload[128];
+    struct aesd_buffer_entry entry;
+    uint32_t i;
+
+    memset(&entry, 0, sizeof(entry));
+    // Overfill by half so the ring has wrapped around
+    for (i = 0; i < capacity + capacity / 2; i++) {
+        entry.buffptr = payload;
+        entry.size = 1 + rand() % sizeof(payload);
+        aesd_circular_buffer_add_entry(buffer, &entry);
+    }
+}
+
+static double time_lookups(struct aesd_circular_buffer *buffer, const size_t *positions,
+            struct aesd_buffer_entry *(*find)(struct aesd_circular_buffer *, size_t, size_t *))
+{
+    volatile size_t sink = 0;
+    double start = now_ns();
+    size_t i, off;
+
+    for (i = 0; i < LOOKUPS; i++)
+        sink += (size_t)find(buffer, positions[i], &off);
+    (void)sink;
+    return (now_ns() - start) / LOOKUPS;
+}
+
+static double time_adds(struct aesd_circular_buffer *buffer)
+{
+    static const char payload[128];
+    struct aesd_buffer_entry entry;
+    volatile size_t sink = 0;
+    double start;
+    uint32_t i;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.buffptr = payload;
+    start = now_ns();
+    for (i = 0; i < ADDS; i++) {
+        entry.size = 1 + (i & 127);
+        sink += (size_t)aesd_circular_buffer_add_entry(buffer, &entry);
+    }
+    (void)sink;
+    return (now_ns() - start) / ADDS;
+}
+
+/**
+ * Fill @param positions with random positions inside the entries stored within
+ * WRAP_SPAN slots of the end of @param buffer's storage array
+ */
+static void wrap_positions(struct aesd_circular_buffer *buffer, size_t *positions)
+{
+    uint32_t count = aesd_circular_buffer_count(buffer);
+    // Index, counted from the oldest entry, of the entry stored in slot 0
+    uint32_t first = (buffer->capacity - buffer->out_offs) % buffer->capacity;
+    uint32_t lo = first >= WRAP_SPAN ? first - WRAP_SPAN : 0;
+    uint32_t hi = first + WRAP_SPAN < count ? first + WRAP_SPAN : count;
+    size_t start = aesd_circular_buffer_entry_fpos(buffer, aesd_circular_buffer_get(buffer, lo));
+    size_t end = hi < count ?
+        aesd_circular_buffer_entry_fpos(buffer, aesd_circular_buffer_get(buffer, hi)) :
+        aesd_circular_buffer_size(buffer);
+    size_t i;
+
+    for (i = 0; i < LOOKUPS; i++)
+        positions[i] = start + ((size_t)rand() * RAND_MAX + rand()) % (end - start);
+}
+
+int main(void)
+{
+    static const uint32_t capacities[] = { 10, 100, 1000, 10000, 65536, 1048576 };
+    size_t *positions = malloc(LOOKUPS * sizeof(*positions));
+    size_t i, c;
+
+    if (positions == NULL)
+        return 1;
+
+    printf("%10s %10s %10s %10s %10s %10s %10s\n", "entries", "add", "seq", "random", "wrap",
+           "index", "scan");
+    for (c = 0; c < sizeof(capacities) / sizeof(capacities[0]); c++) {
+        struct aesd_buffer_entry *storage = calloc(capacities[c], sizeof(*storage));
+        size_t *index = calloc(capacities[c], sizeof(*index));
+        struct aesd_circular_buffer buffer;
+        double t_add, t_seq, t_random, t_wrap, t_index, t_scan = 0;
+        size_t total;
+
+        if (storage == NULL || index == NULL)
+            return 1;
+        aesd_circular_buffer_init_storage(&buffer, storage, capacities[c]);
+        fill(&buffer, capacities[c]);
+        t_add = time_adds(&buffer);
+        total = aesd_circular_buffer_size(&buffer);
+
+        for (i = 0; i < LOOKUPS; i++)
+            positions[i] = i % total;
+        t_seq = time_lookups(&buffer, positions, aesd_circular_buffer_find_entry_offset_for_fpos);
+
+        for (i = 0; i < LOOKUPS; i++)
+            positions[i] = ((size_t)rand() * RAND_MAX + rand()) % total;
+        t_random = time_lookups(&buffer, positions, aesd_circular_buffer_find_entry_offset_for_fpos);
+        // The scan is linear in the ring size, skip it where it would take minutes
+        if (capacities[c] <= 10000)
+            t_scan = time_lookups(&buffer, positions, scan_find);
+        aesd_circular_buffer_set_offs_index(&buffer, index);
+        t_index = time_lookups(&buffer, positions, aesd_circular_buffer_find_entry_offset_for_fpos);
+        aesd_circular_buffer_set_offs_index(&buffer, NULL);
+
+        wrap_positions(&buffer, positions);
+        t_wrap = time_lookups(&buffer, positions, aesd_circular_buffer_find_entry_offset_for_fpos);
+
+        printf("%10u %10.1f %10.1f %10.1f %10.1f %10.1f ", capacities[c], t_add, t_seq, t_random,
+               t_wrap, t_index);
+        if (t_scan)
+            printf("%10.1f\n", t_scan);
+        else
+            printf("%10s\n", "-");
+        free(storage);
+        free(index);
+    }
+    printf("(ns/op)\n");
+
+    free(positions);
+    return 0;
+}
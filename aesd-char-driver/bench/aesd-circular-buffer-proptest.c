@@ -0,0 +1,243 @@
+/**
+ * @file aesd-circular-buffer-proptest.c
+ * @brief Randomized differential test of aesd-circular-buffer.c against a naive model
+ *
+ * Applies random sequences of adds, removals and migrations to an
+ * aesd_circular_buffer and to a model which keeps its entries, oldest first,
+ * in a plain array.  After every step the public queries of the buffer are
+ * compared with the answers computed from the model by linear scans.
+ * Odd seeds run with an offs index attached to the buffer.
+ *
+ * Usage: aesd-circular-buffer-proptest [seed [rounds]]
+ * Exits non-zero and prints the seed and step of the first mismatch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../aesd-circular-buffer.h"
+
+#define MAX_CAPACITY 64
+#define STEPS 2000
+
+struct model
+{
+    struct aesd_buffer_entry entry[MAX_CAPACITY];
+    uint32_t count;
+    uint32_t capacity;
+    /**
+     * Stream position of the next entry added
+     */
+    size_t head_offs;
+};
+
+static unsigned long seed;
+static unsigned long step;
+
+#define CHECK(cond) do {                                                      \
+        if (!(cond)) {                                                        \
+            fprintf(stderr, "seed %lu step %lu: %s failed at line %d\n",      \
+                    seed, step, #cond, __LINE__);                             \
+            exit(1);                                                          \
+        }                                                                     \
+    } while (0)
+
+static void model_add(struct model *m, const struct aesd_buffer_entry *add)
+{
+    if (m->count == m->capacity) {
+        memmove(&m->entry[0], &m->entry[1], (m->count - 1) * sizeof(m->entry[0]));
+        m->count--;
+    }
+    m->entry[m->count] = *add;
+    m->entry[m->count].offs = m->head_offs;
+    m->head_offs += add->size;
+    m->count++;
+}
+
+static void model_remove_oldest(struct model *m)
+{
+    if (m->count == 0)
+        return;
+    memmove(&m->entry[0], &m->entry[1], (m->count - 1) * sizeof(m->entry[0]));
+    m->count--;
+}
+
+static size_t model_size(const struct model *m)
+{
+    size_t size = 0;
+    uint32_t i;
+
+    for (i = 0; i < m->count; i++)
+        size += m->entry[i].size;
+    return size;
+}
+
+/**
+ * @return the model index of the entry holding @param fpos, or -1
+ */
+static int model_find_fpos(const struct model *m, size_t fpos, size_t *entry_offset)
+{
+    size_t start = 0;
+    uint32_t i;
+
+    for (i = 0; i < m->count; i++) {
+        if (fpos < start + m->entry[i].size) {
+            *entry_offset = fpos - start;
+            return i;
+        }
+        start += m->entry[i].size;
+    }
+    return -1;
+}
+
+static int model_find_time(const struct model *m, uint64_t timestamp)
+{
+    uint32_t i;
+
+    for (i = 0; i < m->count; i++)
+        if (m->entry[i].timestamp >= timestamp)
+            return i;
+    return -1;
+}
+
+static bool same_entry(const struct aesd_buffer_entry *a, const struct aesd_buffer_entry *b)
+{
+    return a->buffptr == b->buffptr && a->size == b->size && a->offs == b->offs &&
+           a->timestamp == b->timestamp;
+}
+
+static void check(struct aesd_circular_buffer *buffer, const struct model *m)
+{
+    struct aesd_buffer_entry *entry;
+    size_t size = model_size(m);
+    size_t fpos, offset, model_offset;
+    uint64_t t;
+    uint32_t i;
+    int idx;
+
+    CHECK(aesd_circular_buffer_count(buffer) == m->count);
+    CHECK(aesd_circular_buffer_size(buffer) == size);
+
+    // get and entry_fpos walk the same entries as the model
+    for (i = 0; i < m->count; i++) {
+        entry = aesd_circular_buffer_get(buffer, i);
+        CHECK(entry != NULL);
+        CHECK(same_entry(entry, &m->entry[i]));
+        CHECK(aesd_circular_buffer_entry_fpos(buffer, entry) == m->entry[i].offs - m->entry[0].offs);
+    }
+    CHECK(aesd_circular_buffer_get(buffer, m->count) == NULL);
+
+    // Every position, plus a few past the end
+    for (fpos = 0; fpos < size + 3; fpos++) {
+        offset = model_offset = (size_t)-1;
+        entry = aesd_circular_buffer_find_entry_offset_for_fpos(buffer, fpos, &offset);
+        idx = model_find_fpos(m, fpos, &model_offset);
+        if (idx < 0) {
+            CHECK(entry == NULL);
+        } else {
+            CHECK(entry == aesd_circular_buffer_get(buffer, idx));
+            CHECK(offset == model_offset);
+        }
+    }
+
+    // Every timestamp in use, and the ones next to them
+    for (i = 0; i < m->count; i++) {
+        for (t = m->entry[i].timestamp ? m->entry[i].timestamp - 1 : 0;
+             t <= m->entry[i].timestamp + 1; t++) {
+            idx = model_find_time(m, t);
+            entry = aesd_circular_buffer_find_entry_for_time(buffer, t);
+            CHECK(idx < 0 ? entry == NULL : entry == aesd_circular_buffer_get(buffer, idx));
+        }
+    }
+    CHECK(aesd_circular_buffer_find_entry_for_time(buffer, 0) == aesd_circular_buffer_get(buffer, 0));
+
+    // FOREACH visits every slot of the storage
+    {
+        uint32_t index, visited = 0;
+        AESD_CIRCULAR_BUFFER_FOREACH(entry, buffer, index) {
+            visited++;
+        }
+        CHECK(visited == buffer->capacity);
+    }
+}
+
+/**
+ * @param indexed whether to search through an offs index, see
+ * aesd_circular_buffer_set_offs_index()
+ */
+static void run(bool indexed)
+{
+    static const char payload[STEPS];
+    static size_t index[MAX_CAPACITY];
+    struct aesd_buffer_entry *storage = NULL, *next_storage;
+    struct aesd_circular_buffer buffer;
+    const struct aesd_buffer_entry *overwritten;
+    struct aesd_buffer_entry add;
+    struct model m;
+    uint64_t now = 0;
+
+    memset(&m, 0, sizeof(m));
+    m.capacity = 1 + rand() % MAX_CAPACITY;
+    storage = malloc(m.capacity * sizeof(*storage));
+    CHECK(storage != NULL);
+    aesd_circular_buffer_init_storage(&buffer, storage, m.capacity);
+    if (indexed)
+        aesd_circular_buffer_set_offs_index(&buffer, index);
+
+    for (step = 0; step < STEPS; step++) {
+        int op = rand() % 100;
+
+        if (op < 70) {
+            memset(&add, 0, sizeof(add));
+            // Distinct pointers tell entries apart, zero sized entries included
+            add.buffptr = &payload[step];
+            add.size = rand() % 4 == 0 ? 0 : 1 + rand() % 16;
+            now += rand() % 3;
+            add.timestamp = now;
+            // Non-NULL when the oldest entry was overwritten
+            overwritten = aesd_circular_buffer_add_entry(&buffer, &add);
+            CHECK((overwritten != NULL) == (m.count == m.capacity));
+            model_add(&m, &add);
+        } else if (op < 90) {
+            struct aesd_buffer_entry *removed = aesd_circular_buffer_remove_oldest(&buffer);
+
+            if (m.count == 0) {
+                CHECK(removed == NULL);
+            } else {
+                CHECK(removed != NULL);
+                CHECK(same_entry(removed, &m.entry[0]));
+            }
+            model_remove_oldest(&m);
+        } else {
+            uint32_t capacity = 1 + rand() % MAX_CAPACITY;
+
+            while (m.count > capacity) {
+                CHECK(aesd_circular_buffer_remove_oldest(&buffer) != NULL);
+                model_remove_oldest(&m);
+            }
+            next_storage = malloc(capacity * sizeof(*next_storage));
+            CHECK(next_storage != NULL);
+            aesd_circular_buffer_migrate(&buffer, next_storage, capacity);
+            free(storage);
+            storage = next_storage;
+            m.capacity = capacity;
+            if (indexed)
+                aesd_circular_buffer_set_offs_index(&buffer, index);
+        }
+        check(&buffer, &m);
+    }
+    free(storage);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long first = argc > 1 ? strtoul(argv[1], NULL, 0) : 1;
+    unsigned long rounds = argc > 2 ? strtoul(argv[2], NULL, 0) : 200;
+
+    for (seed = first; seed < first + rounds; seed++) {
+        srand(seed);
+        run(seed & 1);
+    }
+    printf("%lu rounds of %d steps passed\n", rounds, STEPS);
+    return 0;
+}
@@ -0,0 +1,173 @@
+/**
+ * @file aesd-circular-buffer-spmc-bench.c
+ * @brief Throughput of aesd-circular-buffer-spmc.c against a mutex guarded aesd-circular-buffer.c
+ *
+ * One writer adds entries as fast as it can while 1 to 8 readers look up random
+ * positions among the stored entries, for each implementation in turn.  The
+ * mutex version is how user space consumers share an aesd_circular_buffer today.
+ *
+ * Usage: aesd-circular-buffer-spmc-bench [-c capacity] [-t seconds]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../aesd-circular-buffer.h"
+#include "../aesd-circular-buffer-spmc.h"
+
+#define MAX_READERS 8
+
+static struct aesd_circular_buffer_spmc spmc;
+static struct aesd_circular_buffer locked;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t capacity = 4096;
+static bool use_spmc;
+static atomic_bool stop;
+static const char payload[64];
+static volatile size_t sink;
+
+struct counter
+{
+    pthread_t thread;
+    unsigned long ops;
+    /**
+     * Lookups which found no entry, should stay near zero
+     */
+    unsigned long misses;
+} __attribute__((aligned(64)));
+
+static void *writer_main(void *arg)
+{
+    struct counter *c = arg;
+    struct aesd_buffer_entry entry;
+    unsigned long i;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.buffptr = payload;
+    for (i = 0; !atomic_load_explicit(&stop, memory_order_relaxed); i++) {
+        size_t size = 1 + i % sizeof(payload);
+
+        if (use_spmc) {
+            aesd_circular_buffer_spmc_add(&spmc, payload, size);
+        } else {
+            entry.size = size;
+            pthread_mutex_lock(&lock);
+            aesd_circular_buffer_add_entry(&locked, &entry);
+            pthread_mutex_unlock(&lock);
+        }
+        c->ops++;
+    }
+    return NULL;
+}
+
+static void *reader_main(void *arg)
+{
+    struct counter *c = arg;
+    unsigned int rnd = (unsigned int)(uintptr_t)arg;
+    struct aesd_spmc_entry spmc_entry;
+    struct aesd_buffer_entry copy;
+    size_t offset;
+
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        // Average entry size is sizeof(payload) / 2, stay well within the stored span
+        size_t back = 1 + rand_r(&rnd) % (capacity * (sizeof(payload) / 4));
+
+        if (use_spmc) {
+            size_t end = aesd_circular_buffer_spmc_end(&spmc);
+
+            if (back > end ||
+                aesd_circular_buffer_spmc_find(&spmc, end - back, &spmc_entry, &offset) != AESD_SPMC_OK)
+                c->misses++;
+        } else {
+            struct aesd_buffer_entry *entry;
+            size_t size;
+
+            pthread_mutex_lock(&lock);
+            size = aesd_circular_buffer_size(&locked);
+            entry = back > size ? NULL :
+                aesd_circular_buffer_find_entry_offset_for_fpos(&locked, size - back, &offset);
+            // Copy out under the lock, as the spmc lookup does
+            if (entry)
+                copy = *entry;
+            pthread_mutex_unlock(&lock);
+            if (entry)
+                sink = copy.size;
+            else
+                c->misses++;
+        }
+        c->ops++;
+    }
+    return NULL;
+}
+
+static void run(unsigned int nr_readers, unsigned int seconds, double *writes, double *reads,
+                double *misses)
+{
+    struct counter writer, readers[MAX_READERS];
+    unsigned long total = 0;
+    unsigned int i;
+
+    memset(&writer, 0, sizeof(writer));
+    memset(readers, 0, sizeof(readers));
+    atomic_store(&stop, false);
+    pthread_create(&writer.thread, NULL, writer_main, &writer);
+    for (i = 0; i < nr_readers; i++)
+        pthread_create(&readers[i].thread, NULL, reader_main, &readers[i]);
+    sleep(seconds);
+    atomic_store(&stop, true);
+    pthread_join(writer.thread, NULL);
+    for (i = 0; i < nr_readers; i++) {
+        pthread_join(readers[i].thread, NULL);
+        total += readers[i].ops;
+        *misses += readers[i].misses;
+    }
+    *writes = (double)writer.ops / seconds;
+    *reads = (double)total / seconds;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int seconds = 1, nr_readers;
+    struct aesd_buffer_entry *storage;
+    struct aesd_spmc_slot *slots;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:t:")) != -1) {
+        switch (opt) {
+        case 'c': capacity = atoi(optarg); break;
+        case 't': seconds = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-c capacity] [-t seconds]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    storage = calloc(capacity, sizeof(*storage));
+    slots = calloc(capacity, sizeof(*slots));
+    if (!storage || !slots)
+        return 1;
+
+    printf("%u entries, %u s per run\n", capacity, seconds);
+    printf("%8s %14s %14s %14s %14s %10s\n", "readers", "mutex adds/s", "mutex finds/s",
+           "spmc adds/s", "spmc finds/s", "misses");
+    for (nr_readers = 1; nr_readers <= MAX_READERS; nr_readers *= 2) {
+        double mutex_writes, mutex_reads, spmc_writes, spmc_reads, misses = 0;
+
+        use_spmc = false;
+        aesd_circular_buffer_init_storage(&locked, storage, capacity);
+        run(nr_readers, seconds, &mutex_writes, &mutex_reads, &misses);
+
+        use_spmc = true;
+        aesd_circular_buffer_spmc_init(&spmc, slots, capacity);
+        run(nr_readers, seconds, &spmc_writes, &spmc_reads, &misses);
+
+        printf("%8u %14.0f %14.0f %14.0f %14.0f %10.0f\n", nr_readers, mutex_writes, mutex_reads,
+               spmc_writes, spmc_reads, misses);
+    }
+
+    free(storage);
+    free(slots);
+    return 0;
+}
@@ -0,0 +1,187 @@
+/**
+ * @file aesd-circular-buffer-spmc-stress.c
+ * @brief Concurrent correctness test of aesd-circular-buffer-spmc.c
+ *
+ * One writer adds entries as fast as it can while readers look entries up by
+ * stream position and by sequence number, near the head where they race the
+ * writer.  Entry sizes and stream positions are a function of the sequence
+ * number, so readers can check every entry they get.  buffptr points at an
+ * arena slot the writer stores the sequence number in, and reuses as soon as
+ * the contract of aesd_circular_buffer_spmc_valid() allows, so readers also
+ * check that validation catches data changed under them.
+ *
+ * Usage: aesd-circular-buffer-spmc-stress [-r readers] [-t seconds]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "../aesd-circular-buffer-spmc.h"
+
+static const uint32_t capacities[] = { 1, 2, 7, 64, 4096 };
+
+static struct aesd_circular_buffer_spmc ring;
+// One slot more than the ring, so a slot is reused right after its entry is overwritten
+static _Atomic uint64_t *arena;
+static uint32_t arena_size;
+static atomic_bool stop;
+static atomic_ulong errors;
+
+static size_t size_of(uint64_t seq)
+{
+    return seq % 8;
+}
+
+/**
+ * @return the sum of size_of() over all entries before @param seq
+ */
+static size_t offs_of(uint64_t seq)
+{
+    uint64_t r = seq % 8;
+
+    return (seq / 8) * 28 + r * (r - 1) / 2;
+}
+
+static void fail(const char *what, uint64_t seq)
+{
+    if (atomic_fetch_add(&errors, 1) < 10)
+        fprintf(stderr, "capacity %u seq %llu: %s\n", ring.capacity,
+                (unsigned long long)seq, what);
+}
+
+static void *writer_main(void *arg)
+{
+    uint64_t seq;
+
+    for (seq = 0; !atomic_load_explicit(&stop, memory_order_relaxed); seq++) {
+        _Atomic uint64_t *data = &arena[seq % arena_size];
+
+        atomic_store_explicit(data, seq, memory_order_relaxed);
+        if (aesd_circular_buffer_spmc_add(&ring, (const char *)data, size_of(seq)) != offs_of(seq))
+            fail("add returned the wrong position", seq);
+    }
+    return arg;
+}
+
+static void check_entry(const struct aesd_spmc_entry *entry)
+{
+    uint64_t data;
+
+    if (entry->size != size_of(entry->seq) || entry->offs != offs_of(entry->seq))
+        fail("torn entry", entry->seq);
+    if (entry->buffptr != (const char *)&arena[entry->seq % arena_size])
+        fail("wrong buffptr", entry->seq);
+    data = atomic_load_explicit((_Atomic uint64_t *)entry->buffptr, memory_order_relaxed);
+    if (aesd_circular_buffer_spmc_valid(&ring, entry->seq) && data != entry->seq)
+        fail("data changed while the entry was valid", entry->seq);
+}
+
+static void *reader_main(void *arg)
+{
+    unsigned long *lookups = arg;
+    unsigned int rnd = (unsigned int)(uintptr_t)arg;
+    // Span the stored entries, plus some already evicted and some not yet written
+    long long window = (long long)ring.capacity * 8 + 8;
+    struct aesd_spmc_entry entry;
+    size_t offset;
+
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        uint64_t head = atomic_load_explicit(&ring.head, memory_order_acquire);
+        size_t end = aesd_circular_buffer_spmc_end(&ring);
+        long long pos = (long long)end + window / 4 - rand_r(&rnd) % window;
+        long long seq = (long long)head + ring.capacity / 4 + 1 - rand_r(&rnd) % (ring.capacity + 2);
+        uint64_t later;
+
+        if (pos >= 0) {
+            switch (aesd_circular_buffer_spmc_find(&ring, pos, &entry, &offset)) {
+            case AESD_SPMC_OK:
+                check_entry(&entry);
+                if (offset >= entry.size || entry.offs + offset != (size_t)pos)
+                    fail("find returned an entry not holding pos", entry.seq);
+                break;
+            case AESD_SPMC_NOT_WRITTEN:
+                if ((size_t)pos < end)
+                    fail("find reported a written position as not written", pos);
+                break;
+            case AESD_SPMC_OVERWRITTEN:
+                // Evicted positions precede the oldest entry stored after the lookup,
+                // other than the one the next add overwrites
+                later = atomic_load_explicit(&ring.head, memory_order_acquire);
+                if ((size_t)pos >= offs_of(later >= ring.capacity ? later - ring.capacity + 1 : 0))
+                    fail("find reported a stored position as overwritten", pos);
+                break;
+            }
+        }
+
+        if (seq >= 0) {
+            switch (aesd_circular_buffer_spmc_get(&ring, seq, &entry)) {
+            case AESD_SPMC_OK:
+                if (entry.seq != (uint64_t)seq)
+                    fail("get returned another entry", seq);
+                check_entry(&entry);
+                break;
+            case AESD_SPMC_NOT_WRITTEN:
+                if ((uint64_t)seq < head)
+                    fail("get reported a written entry as not written", seq);
+                break;
+            case AESD_SPMC_OVERWRITTEN:
+                later = atomic_load_explicit(&ring.head, memory_order_acquire);
+                if ((uint64_t)seq < later && later - seq < ring.capacity)
+                    fail("get reported a stored entry as overwritten", seq);
+                break;
+            }
+        }
+        (*lookups)++;
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int nr_readers = 4, seconds = 1, i, c;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:t:")) != -1) {
+        switch (opt) {
+        case 'r': nr_readers = atoi(optarg); break;
+        case 't': seconds = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-r readers] [-t seconds]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    for (c = 0; c < sizeof(capacities) / sizeof(capacities[0]); c++) {
+        struct aesd_spmc_slot *storage = malloc(capacities[c] * sizeof(*storage));
+        unsigned long *lookups = calloc(nr_readers, sizeof(*lookups));
+        pthread_t writer, *readers = calloc(nr_readers, sizeof(*readers));
+        unsigned long total = 0;
+
+        arena_size = capacities[c] + 1;
+        arena = calloc(arena_size, sizeof(*arena));
+        if (!storage || !lookups || !readers || !arena)
+            return 1;
+        aesd_circular_buffer_spmc_init(&ring, storage, capacities[c]);
+
+        atomic_store(&stop, false);
+        pthread_create(&writer, NULL, writer_main, NULL);
+        for (i = 0; i < nr_readers; i++)
+            pthread_create(&readers[i], NULL, reader_main, &lookups[i]);
+        sleep(seconds);
+        atomic_store(&stop, true);
+        pthread_join(writer, NULL);
+        for (i = 0; i < nr_readers; i++) {
+            pthread_join(readers[i], NULL);
+            total += lookups[i];
+        }
+
+        printf("capacity %5u: %llu entries added, %lu lookups, %lu errors\n", capacities[c],
+               (unsigned long long)atomic_load(&ring.head), total, atomic_load(&errors));
+        free(storage);
+        free(lookups);
+        free(readers);
+        free(arena);
+    }
+    return atomic_load(&errors) ? 1 : 0;
+}
@@ -0,0 +1,269 @@
+/**
+ * @file aesdchar-bench.c
+ * @brief Throughput of the aesdchar driver logic, built in user space
+ *
+ * Runs main.c, aesd-record.c and aesd-circular-buffer.c against the stand-ins
+ * of shim/aesd-shim.h, so driver changes can be measured without loading the
+ * module.  Absolute numbers differ from the kernel, where copies cross the
+ * user boundary and locks behave differently under contention, but relative
+ * changes to the driver's own work show up.
+ *
+ * For each record size and ring capacity it measures:
+ * - write: one record per write
+ * - writev: 64 records per writev
+ * - read: reading the whole history with 64 KiB reads
+ * - seek: AESDCHAR_IOCSEEKTO to a random entry, then llseek back to the start
+ * Then writer and reader threads share one device for a few seconds.
+ *
+ * Usage: aesdchar-bench [-w writers] [-r readers] [-t seconds]
+ */
+
+#include "aesd-shim.h"
+#include "../aesdchar.h"
+#include "../aesd_ioctl.h"
+
+#define READ_CHUNK (64 * 1024)
+#define WRITEV_BATCH 64
+// Bytes written per size and capacity, enough to wrap the largest ring
+#define WRITE_BYTES (64 * 1024 * 1024)
+#define MAX_WRITE_RECORDS (1024 * 1024)
+#define SEEKS 200000
+
+static const size_t record_sizes[] = { 16, 256, 4096, 65536 };
+static const uint32_t capacities[] = { 10, 1024, 65536 };
+
+static unsigned int nr_writers = 4;
+static unsigned int nr_readers = 4;
+static unsigned int seconds = 2;
+static volatile bool stop;
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill_record(char *rec, size_t size, unsigned long seq)
+{
+    memset(rec, 'a' + seq % 26, size - 1);
+    rec[size - 1] = '\n';
+}
+
+static void resize(struct file *filp, uint32_t capacity)
+{
+    long ret = aesd_fops.unlocked_ioctl(filp, AESDCHAR_IOCRESIZE, (unsigned long)&capacity);
+
+    if (ret) {
+        fprintf(stderr, "resize to %u failed: %ld\n", capacity, ret);
+        exit(1);
+    }
+}
+
+static void bench_one(size_t size, uint32_t capacity)
+{
+    struct inode inode;
+    struct file filp;
+    struct iovec iov[WRITEV_BATCH];
+    unsigned long records = min(WRITE_BYTES / size, MAX_WRITE_RECORDS);
+    char *rec = malloc(size * WRITEV_BATCH);
+    char *buf = malloc(READ_CHUNK);
+    unsigned long i, total = 0;
+    double t0, t_write, t_writev, t_read, t_seek;
+    ssize_t n;
+
+    if (!rec || !buf || aesd_shim_open(&inode, &filp, 0, O_RDWR)) {
+        fprintf(stderr, "setup failed\n");
+        exit(1);
+    }
+    // Shrinking to one entry and back empties the ring between runs
+    resize(&filp, 1);
+    resize(&filp, capacity);
+
+    for (i = 0; i < WRITEV_BATCH; i++) {
+        fill_record(rec + i * size, size, i);
+        iov[i].iov_base = rec + i * size;
+        iov[i].iov_len = size;
+    }
+
+    t0 = now_s();
+    for (i = 0; i < records; i++) {
+        if (aesd_shim_write(&filp, rec, size) != (ssize_t)size) {
+            fprintf(stderr, "write failed\n");
+            exit(1);
+        }
+    }
+    t_write = now_s() - t0;
+
+    t0 = now_s();
+    for (i = 0; i < records; i += WRITEV_BATCH) {
+        if (aesd_shim_writev(&filp, iov, WRITEV_BATCH) != (ssize_t)(size * WRITEV_BATCH)) {
+            fprintf(stderr, "writev failed\n");
+            exit(1);
+        }
+    }
+    t_writev = now_s() - t0;
+
+    // Read the whole history a few times, at least 64 MiB in total
+    t0 = now_s();
+    do {
+        loff_t pos = 0;
+
+        while ((n = aesd_shim_pread(&filp, buf, READ_CHUNK, pos)) > 0) {
+            pos += n;
+            total += n;
+        }
+    } while (total < WRITE_BYTES);
+    t_read = now_s() - t0;
+
+    t0 = now_s();
+    for (i = 0; i < SEEKS; i++) {
+        struct aesd_seekto seekto = { (uint32_t)(i * 2654435761u) % capacity, 0 };
+
+        aesd_fops.unlocked_ioctl(&filp, AESDCHAR_IOCSEEKTO, (unsigned long)&seekto);
+        aesd_fops.llseek(&filp, 0, SEEK_SET);
+    }
+    t_seek = now_s() - t0;
+
+    printf("%8zu %8u %12.0f %12.0f %10.1f %12.0f\n", size, capacity,
+           records / t_write, records / t_writev, total / t_read / 1e6, SEEKS / t_seek);
+
+    aesd_shim_close(&inode, &filp);
+    free(rec);
+    free(buf);
+}
+
+struct worker
+{
+    pthread_t thread;
+    unsigned long ops;
+    unsigned long long bytes;
+};
+
+static void *writer_main(void *arg)
+{
+    struct worker *w = arg;
+    struct inode inode;
+    struct file filp;
+    char rec[128];
+
+    fill_record(rec, sizeof(rec), 0);
+    if (aesd_shim_open(&inode, &filp, 0, O_WRONLY))
+        return NULL;
+    while (!stop) {
+        if (aesd_shim_write(&filp, rec, sizeof(rec)) != sizeof(rec))
+            break;
+        w->ops++;
+        w->bytes += sizeof(rec);
+    }
+    aesd_shim_close(&inode, &filp);
+    return NULL;
+}
+
+static void *reader_main(void *arg)
+{
+    struct worker *w = arg;
+    struct inode inode;
+    struct file filp;
+    char *buf = malloc(READ_CHUNK);
+
+    if (!buf || aesd_shim_open(&inode, &filp, 0, O_RDONLY)) {
+        free(buf);
+        return NULL;
+    }
+    while (!stop) {
+        ssize_t n = aesd_shim_pread(&filp, buf, READ_CHUNK, 0);
+
+        if (n < 0)
+            break;
+        w->ops++;
+        w->bytes += n;
+    }
+    aesd_shim_close(&inode, &filp);
+    free(buf);
+    return NULL;
+}
+
+static void bench_contention(void)
+{
+    struct worker *writers = calloc(nr_writers, sizeof(*writers));
+    struct worker *readers = calloc(nr_readers, sizeof(*readers));
+    unsigned long long wbytes = 0, rbytes = 0;
+    unsigned long wops = 0, rops = 0;
+    char lock_wait[64] = "", before[64] = "";
+    struct inode inode;
+    struct file filp;
+    unsigned int i;
+    double t0, elapsed;
+
+    if (!writers || !readers || aesd_shim_open(&inode, &filp, 0, O_RDWR))
+        exit(1);
+    resize(&filp, 1);
+    resize(&filp, 1024);
+    aesd_shim_sysfs(0, "lock_wait_ns", NULL, before);
+
+    stop = false;
+    t0 = now_s();
+    for (i = 0; i < nr_writers; i++)
+        pthread_create(&writers[i].thread, NULL, writer_main, &writers[i]);
+    for (i = 0; i < nr_readers; i++)
+        pthread_create(&readers[i].thread, NULL, reader_main, &readers[i]);
+    sleep(seconds);
+    stop = true;
+    for (i = 0; i < nr_writers; i++) {
+        pthread_join(writers[i].thread, NULL);
+        wops += writers[i].ops;
+        wbytes += writers[i].bytes;
+    }
+    for (i = 0; i < nr_readers; i++) {
+        pthread_join(readers[i].thread, NULL);
+        rops += readers[i].ops;
+        rbytes += readers[i].bytes;
+    }
+    elapsed = now_s() - t0;
+    aesd_shim_sysfs(0, "lock_wait_ns", NULL, lock_wait);
+
+    printf("\n%u writers of 128 byte records, %u readers of the whole history, 1024 entries\n",
+           nr_writers, nr_readers);
+    printf("writes %12.0f records/s %10.1f MB/s\n", wops / elapsed, wbytes / elapsed / 1e6);
+    printf("reads  %12.0f reads/s   %10.1f MB/s\n", rops / elapsed, rbytes / elapsed / 1e6);
+    printf("lock wait %.3f s\n", (strtoull(lock_wait, NULL, 10) - strtoull(before, NULL, 10)) / 1e9);
+
+    aesd_shim_close(&inode, &filp);
+    free(writers);
+    free(readers);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int i, j;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:r:t:")) != -1) {
+        switch (opt) {
+        case 'w': nr_writers = atoi(optarg); break;
+        case 'r': nr_readers = atoi(optarg); break;
+        case 't': seconds = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-w writers] [-r readers] [-t seconds]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (aesd_shim_module_init()) {
+        fprintf(stderr, "driver init failed\n");
+        return 1;
+    }
+
+    printf("%8s %8s %12s %12s %10s %12s\n", "size", "entries", "write/s", "writev rec/s",
+           "read MB/s", "seek/s");
+    for (i = 0; i < sizeof(record_sizes) / sizeof(record_sizes[0]); i++)
+        for (j = 0; j < sizeof(capacities) / sizeof(capacities[0]); j++)
+            bench_one(record_sizes[i], capacities[j]);
+
+    bench_contention();
+
+    aesd_shim_module_exit();
+    return 0;
+}
@@ -0,0 +1,253 @@
+/**
+ * @file aesdchar-stress.c
+ * @brief Concurrent reader/writer stress and throughput test for /dev/aesdchar
+ *
+ * Writer threads append newline terminated records, batch records per writev, while
+ * reader threads repeatedly read the whole history with pread.  Every record a
+ * reader sees must be intact, and the records of each writer must appear in
+ * the order they were written.  Reads do not take the device lock, so reader
+ * throughput should scale with the number of readers.
+ *
+ * Usage: aesdchar-stress [-d device] [-r readers] [-w writers] [-t seconds] [-s record_size]
+ *                       [-b batch]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define MAX_WRITERS 64
+#define MAX_BATCH 1024
+#define READ_BUF_SIZE (4 * 1024 * 1024)
+
+// "<writer> <sequence> " before the payload
+#define HEADER_LEN 15
+
+static const char *device = "/dev/aesdchar";
+static unsigned int nr_readers = 4;
+static unsigned int nr_writers = 1;
+static unsigned int seconds = 5;
+static size_t record_size = 64;
+static unsigned int batch = 1;
+static volatile bool stop;
+
+struct worker
+{
+    pthread_t thread;
+    unsigned int id;
+    unsigned long ops;
+    unsigned long long bytes;
+    unsigned long errors;
+};
+
+static char payload_char(unsigned int writer, unsigned long seq)
+{
+    return 'a' + (writer + seq) % 26;
+}
+
+static void *writer_main(void *arg)
+{
+    struct worker *w = arg;
+    char *buf = malloc(record_size * batch);
+    struct iovec iov[MAX_BATCH];
+    ssize_t len = record_size * batch;
+    unsigned long seq = 0;
+    unsigned int i;
+    int fd = open(device, O_WRONLY | O_APPEND);
+
+    if (fd < 0 || buf == NULL) {
+        perror(device);
+        w->errors++;
+        free(buf);
+        return NULL;
+    }
+
+    for (i = 0; i < batch; i++) {
+        iov[i].iov_base = buf + i * record_size;
+        iov[i].iov_len = record_size;
+    }
+
+    while (!stop) {
+        for (i = 0; i < batch; i++, seq++) {
+            char *rec = iov[i].iov_base;
+
+            snprintf(rec, HEADER_LEN + 1, "%02u %011lu ", w->id, seq);
+            memset(rec + HEADER_LEN, payload_char(w->id, seq), record_size - HEADER_LEN - 1);
+            rec[record_size - 1] = '\n';
+        }
+        if (writev(fd, iov, batch) != len) {
+            perror("writev");
+            w->errors++;
+            break;
+        }
+        w->ops += batch;
+        w->bytes += len;
+    }
+
+    close(fd);
+    free(buf);
+    return NULL;
+}
+
+/*
+ * @return the number of malformed or out of order records in buf
+ */
+static unsigned long check_history(const char *buf, size_t len)
+{
+    long last_seq[MAX_WRITERS];
+    unsigned long errors = 0;
+    const char *p = buf, *end = buf + len;
+    size_t i;
+
+    for (i = 0; i < MAX_WRITERS; i++)
+        last_seq[i] = -1;
+
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        unsigned int writer;
+        unsigned long seq;
+        const char *q;
+
+        // A record is always returned whole
+        if (nl == NULL || (size_t)(nl - p + 1) != record_size ||
+            sscanf(p, "%2u %11lu ", &writer, &seq) != 2 || writer >= nr_writers) {
+            errors++;
+            break;
+        }
+        for (q = p + HEADER_LEN; q < nl; q++) {
+            if (*q != payload_char(writer, seq)) {
+                errors++;
+                break;
+            }
+        }
+        if ((long)seq <= last_seq[writer])
+            errors++;
+        last_seq[writer] = seq;
+        p = nl + 1;
+    }
+    return errors;
+}
+
+static void *reader_main(void *arg)
+{
+    struct worker *w = arg;
+    char *buf = malloc(READ_BUF_SIZE);
+    int fd = open(device, O_RDONLY);
+
+    if (fd < 0 || buf == NULL) {
+        perror(device);
+        w->errors++;
+        free(buf);
+        return NULL;
+    }
+
+    while (!stop) {
+        ssize_t n = pread(fd, buf, READ_BUF_SIZE, 0);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("pread");
+            w->errors++;
+            break;
+        }
+        w->errors += check_history(buf, n);
+        w->ops++;
+        w->bytes += n;
+    }
+
+    close(fd);
+    free(buf);
+    return NULL;
+}
+
+static void report(const char *what, const struct worker *w, unsigned int n, double elapsed,
+                   unsigned long *errors)
+{
+    unsigned long ops = 0;
+    unsigned long long bytes = 0;
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        ops += w[i].ops;
+        bytes += w[i].bytes;
+        *errors += w[i].errors;
+    }
+    printf("%-8s %3u threads %12.0f ops/s %10.1f MB/s\n", what, n,
+           ops / elapsed, bytes / elapsed / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+    struct worker *readers, *writers;
+    struct timespec start, end;
+    unsigned long errors = 0;
+    double elapsed;
+    unsigned int i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:r:w:t:s:b:")) != -1) {
+        switch (opt) {
+        case 'd': device = optarg; break;
+        case 'r': nr_readers = atoi(optarg); break;
+        case 'w': nr_writers = atoi(optarg); break;
+        case 't': seconds = atoi(optarg); break;
+        case 's': record_size = strtoul(optarg, NULL, 0); break;
+        case 'b': batch = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-d device] [-r readers] [-w writers] "
+                    "[-t seconds] [-s record_size] [-b batch]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (batch == 0 || batch > MAX_BATCH) {
+        fprintf(stderr, "Need a batch of 1 to %d records\n", MAX_BATCH);
+        return 2;
+    }
+    if (nr_writers == 0 || nr_writers > MAX_WRITERS || record_size <= HEADER_LEN + 1) {
+        fprintf(stderr, "Need 1 to %d writers and records longer than %d bytes\n",
+                MAX_WRITERS, HEADER_LEN + 1);
+        return 2;
+    }
+
+    readers = calloc(nr_readers, sizeof(*readers));
+    writers = calloc(nr_writers, sizeof(*writers));
+    if (readers == NULL || writers == NULL)
+        return 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nr_writers; i++) {
+        writers[i].id = i;
+        pthread_create(&writers[i].thread, NULL, writer_main, &writers[i]);
+    }
+    for (i = 0; i < nr_readers; i++) {
+        readers[i].id = i;
+        pthread_create(&readers[i].thread, NULL, reader_main, &readers[i]);
+    }
+
+    sleep(seconds);
+    stop = true;
+
+    for (i = 0; i < nr_writers; i++)
+        pthread_join(writers[i].thread, NULL);
+    for (i = 0; i < nr_readers; i++)
+        pthread_join(readers[i].thread, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    report("writers", writers, nr_writers, elapsed, &errors);
+    report("readers", readers, nr_readers, elapsed, &errors);
+    printf("errors   %lu\n", errors);
+
+    free(readers);
+    free(writers);
+    return errors ? 1 : 0;
+}
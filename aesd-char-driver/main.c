@@ -17,200 +17,808 @@
 #include <linux/types.h>
 #include <linux/cdev.h>
 #include <linux/fs.h> // file_operations
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/err.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/mm.h>
+#include <linux/device.h>
+#include <linux/version.h>
+#include <linux/ktime.h>
 #include "aesdchar.h"
 #include "aesd_ioctl.h"
+
+#define CREATE_TRACE_POINTS
+#include "aesd-trace.h"
+
 int aesd_major =   0; // use dynamic major
 int aesd_minor =   0;
 
+static unsigned int ring_capacity = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+module_param(ring_capacity, uint, 0444);
+MODULE_PARM_DESC(ring_capacity, "Number of completed writes kept by the device");
+
+#define AESD_MAX_MMAP_SIZE (64 << 20)
+
+static unsigned int mmap_size = 1 << 20;
+module_param(mmap_size, uint, 0444);
+MODULE_PARM_DESC(mmap_size, "Bytes of records kept for mmap, rounded up to pages, 0 disables mmap");
+
+#define AESD_MAX_DEVS 256
+
+static unsigned int nr_devs = 1;
+module_param(nr_devs, uint, 0444);
+MODULE_PARM_DESC(nr_devs, "Number of independent devices, /dev/aesdchar0 to /dev/aesdchar<nr_devs - 1>");
+
+static unsigned long max_bytes;
+module_param(max_bytes, ulong, 0444);
+MODULE_PARM_DESC(max_bytes, "Initial limit on the bytes kept by each device, 0 for no limit");
+
 MODULE_AUTHOR("Your Name Here"); /** TODO: fill in your name **/
 MODULE_LICENSE("Dual BSD/GPL");
-struct aesd_dev aesd_device;
+struct aesd_dev *aesd_devices;
+static struct class *aesd_class;
 
 static void free_all_entries(struct aesd_circular_buffer *buf)
 {
-    uint8_t idx;
+    uint32_t idx;
     struct aesd_buffer_entry *entry;
 
     AESD_CIRCULAR_BUFFER_FOREACH(entry, buf, idx) {
-        if (entry->buffptr) {
-            kfree((void *)entry->buffptr);
-            entry->buffptr = NULL;
+        if (entry->priv) {
+            aesd_record_put(entry->priv);
+            entry->priv = NULL;
             entry->size = 0;
         }
     }
 }
 
+static void aesd_lock_wait_done(struct aesd_dev *dev, u64 start)
+{
+    u64 wait_ns = ktime_get_ns() - start;
+
+    atomic64_add(wait_ns, &dev->stats.lock_wait_ns);
+    trace_aesdchar_lock_wait(dev->index, wait_ns);
+}
+
+/*
+ * Take dev->lock, accounting the time spent waiting for it when it is
+ * contended.  The uncontended case costs no clock reads.
+ */
+static void aesd_lock(struct aesd_dev *dev)
+{
+    u64 start;
+
+    if (mutex_trylock(&dev->lock))
+        return;
+    start = ktime_get_ns();
+    mutex_lock(&dev->lock);
+    aesd_lock_wait_done(dev, start);
+}
+
+static int aesd_lock_interruptible(struct aesd_dev *dev)
+{
+    u64 start;
+    int err;
+
+    if (mutex_trylock(&dev->lock))
+        return 0;
+    start = ktime_get_ns();
+    err = mutex_lock_interruptible(&dev->lock);
+    if (!err)
+        aesd_lock_wait_done(dev, start);
+    return err;
+}
+
+/*
+ * Drop the oldest entry, with dev->lock and the seqcount write side held
+ */
+static void aesd_evict_oldest(struct aesd_dev *dev)
+{
+    struct aesd_buffer_entry *oldest = aesd_circular_buffer_remove_oldest(&dev->circbuf);
+
+    trace_aesdchar_evict(dev->index, oldest->offs, oldest->size);
+    atomic64_inc(&dev->stats.evictions);
+    aesd_record_put(oldest->priv);
+    oldest->priv = NULL;
+    oldest->size = 0;
+}
+
+/*
+ * Evict the oldest entries until at most @limit bytes are stored, with
+ * dev->lock and the seqcount write side held
+ */
+static void aesd_evict_to_size(struct aesd_dev *dev, size_t limit)
+{
+    while (aesd_circular_buffer_count(&dev->circbuf) &&
+           aesd_circular_buffer_size(&dev->circbuf) > limit)
+        aesd_evict_oldest(dev);
+}
+
+/*
+ * Replace the ring storage with room for @capacity entries, dropping the
+ * oldest entries if there are more than that.  Lockless readers may still be
+ * indexing the old storage, so it is freed after a grace period.
+ */
+static int aesd_resize(struct aesd_dev *dev, uint32_t capacity)
+{
+    struct aesd_buffer_entry *entries, *old;
+
+    if (capacity == 0 || capacity > AESDCHAR_MAX_RING_CAPACITY)
+        return -EINVAL;
+
+    entries = kvcalloc(capacity, sizeof(*entries), GFP_KERNEL);
+    if (!entries) {
+        atomic64_inc(&dev->stats.enomem);
+        return -ENOMEM;
+    }
+
+    if (aesd_lock_interruptible(dev)) {
+        kvfree(entries);
+        return -ERESTARTSYS;
+    }
+
+    write_seqcount_begin(&dev->seq);
+    while (aesd_circular_buffer_count(&dev->circbuf) > capacity)
+        aesd_evict_oldest(dev);
+
+    old = dev->circbuf.entry;
+    aesd_circular_buffer_migrate(&dev->circbuf, entries, capacity);
+    write_seqcount_end(&dev->seq);
+
+    if (dev->mmap)
+        aesd_mmap_trim(dev->mmap, dev->write_seq - aesd_circular_buffer_count(&dev->circbuf));
+    mutex_unlock(&dev->lock);
+
+    synchronize_rcu();
+    kvfree(old);
+    return 0;
+}
+
 int aesd_open(struct inode *inode, struct file *filp)
 {
-    struct aesd_dev *dev;
+    struct aesd_file *file;
 
     PDEBUG("open");
 
-    dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
-    filp->private_data = dev; // for other methods
+    file = kzalloc(sizeof(*file), GFP_KERNEL);
+    if (!file)
+        return -ENOMEM;
+
+    file->dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
+    mutex_init(&file->write_lock);
+    filp->private_data = file; // for other methods
 
     return 0;
 }
 
+/*
+ * Hand an unterminated command over to the device, so it is continued by the
+ * next write as it was before each file had its own working record
+ */
+static void aesd_orphan_record(struct aesd_dev *dev, struct aesd_record *working)
+{
+    aesd_lock(dev);
+    if (!dev->orphan) {
+        dev->orphan = working;
+        working = NULL;
+    } else if ((dev->max_bytes && dev->orphan->size + working->size > dev->max_bytes) ||
+               aesd_record_append_record(dev->orphan, working)) {
+        printk(KERN_WARNING "aesdchar: dropped %zu unterminated bytes\n", working->size);
+    }
+    mutex_unlock(&dev->lock);
+    aesd_record_put(working);
+}
+
 int aesd_release(struct inode *inode, struct file *filp)
 {
+    struct aesd_file *file = filp->private_data;
+
     PDEBUG("release");
-    // nothing specific to release per-file in this assignment
+    if (file->working)
+        aesd_orphan_record(file->dev, file->working);
+    kfree(file);
     return 0;
 }
 
 /*
- * Read returns data spanning the most recent 10 newline-terminated writes,
- * in order of receipt, respecting *f_pos and count.
+ * Copy the fields of dev->circbuf describing its contents into @snap, for use
+ * with the aesd_circular_buffer functions once read_seqcount_retry() has
+ * confirmed no writer changed them meanwhile.  Call with rcu_read_lock() held,
+ * so the entry storage stays valid.
  */
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
-                  loff_t *f_pos)
+static void aesd_snapshot_ring(struct aesd_dev *dev, struct aesd_circular_buffer *snap)
 {
-    struct aesd_dev *dev = filp->private_data;
-    ssize_t retval = 0;
+    snap->entry = READ_ONCE(dev->circbuf.entry);
+    snap->capacity = READ_ONCE(dev->circbuf.capacity);
+    snap->in_offs = READ_ONCE(dev->circbuf.in_offs);
+    snap->out_offs = READ_ONCE(dev->circbuf.out_offs);
+    snap->full = READ_ONCE(dev->circbuf.full);
+    snap->head_offs = READ_ONCE(dev->circbuf.head_offs);
+}
+
+/*
+ * Store the stream positions of the oldest stored byte and of the end of the
+ * data, without taking dev->lock.
+ */
+static void aesd_stream_bounds(struct aesd_dev *dev, size_t *oldest, size_t *head)
+{
+    struct aesd_circular_buffer snap;
+    unsigned int seq;
+
+    rcu_read_lock();
+    do {
+        seq = read_seqcount_begin(&dev->seq);
+        aesd_snapshot_ring(dev, &snap);
+        if (read_seqcount_retry(&dev->seq, seq))
+            continue;
+
+        *head = snap.head_offs;
+        *oldest = snap.head_offs - aesd_circular_buffer_size(&snap);
+    } while (read_seqcount_retry(&dev->seq, seq));
+    rcu_read_unlock();
+}
+
+/*
+ * Called when a following reader finds no data at its position.  Waits until
+ * the stream extends past file->stream_pos, then points *@pos at the first
+ * byte after it, or at the oldest byte if that one was already evicted.
+ * @return 0, -EAGAIN if the file may not block, or -ERESTARTSYS
+ */
+static int aesd_wait_for_data(struct aesd_file *file, bool nonblock, loff_t *pos)
+{
+    struct aesd_dev *dev = file->dev;
+    size_t oldest, head;
+
+    aesd_stream_bounds(dev, &oldest, &head);
+    if (head == file->stream_pos) {
+        if (nonblock)
+            return -EAGAIN;
+        if (wait_event_interruptible(dev->wq,
+                                     READ_ONCE(dev->circbuf.head_offs) != file->stream_pos))
+            return -ERESTARTSYS;
+        aesd_stream_bounds(dev, &oldest, &head);
+    }
+
+    *pos = file->stream_pos > oldest ? file->stream_pos - oldest : 0;
+    return 0;
+}
+
+#define AESD_BASE_OLDEST SIZE_MAX
+
+/*
+ * Find the record holding byte @pos without taking dev->lock.  @pos counts
+ * from stream position *@base, or from the oldest entry if *@base is
+ * AESD_BASE_OLDEST, in which case *@base is set to that entry's stream
+ * position so later lookups are not shifted by evictions.
+ *
+ * The snapshot is validated before it is searched, so indices always fall
+ * inside the entry storage, and again afterwards, so the entry found was not
+ * replaced while it was read.  The record is pinned before leaving the RCU
+ * read side section; a zero count means it was evicted after validation, and
+ * the lookup retries.
+ * @return the record with a reference held for the caller, or NULL if @pos is
+ * past the end of the stored data or was already evicted
+ */
+static struct aesd_record *aesd_find_record(struct aesd_dev *dev, size_t pos, size_t *base,
+                                            size_t *entry_offset, u32 *crc)
+{
+    struct aesd_circular_buffer snap;
     struct aesd_buffer_entry *entry;
-    size_t entry_offset = 0;
-    size_t bytes_avail, to_copy;
+    struct aesd_record *record;
+    size_t oldest, start = 0;
+    unsigned int seq;
+
+    rcu_read_lock();
+    do {
+        record = NULL;
+        seq = read_seqcount_begin(&dev->seq);
+        aesd_snapshot_ring(dev, &snap);
+        if (read_seqcount_retry(&dev->seq, seq))
+            continue;
+
+        oldest = snap.head_offs - aesd_circular_buffer_size(&snap);
+        start = *base == AESD_BASE_OLDEST ? oldest : *base;
+        // Evicted since *base was taken
+        if (start + pos < oldest)
+            continue;
+
+        entry = aesd_circular_buffer_find_entry_offset_for_fpos(&snap, start + pos - oldest,
+                                                                 entry_offset);
+        if (entry) {
+            record = READ_ONCE(entry->priv);
+            *crc = READ_ONCE(entry->crc32c);
+        }
+    } while (read_seqcount_retry(&dev->seq, seq) ||
+             (record && !refcount_inc_not_zero(&record->refs)));
+    rcu_read_unlock();
+
+    if (record)
+        *base = start;
+    return record;
+}
 
-    PDEBUG("read %zu bytes with offset %lld", count, *f_pos);
+/*
+ * Read returns data spanning the most recent completed writes, in order of
+ * receipt, starting at ki_pos.  Consecutive entries are copied until the
+ * destination is full, so one read (or readv) can drain the whole history.
+ *
+ * Readers never take dev->lock: each entry is looked up with
+ * aesd_find_record() and copied while holding a reference on its record.
+ * Entries after the first are located by stream position, so a concurrent
+ * eviction ends the read early rather than shifting it into another entry.
+ *
+ * At the end of the data, read returns 0 unless the file is following
+ * (AESDCHAR_IOCFOLLOW), in which case it waits for the next record, or
+ * returns -EAGAIN for non-blocking files.
+ */
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct aesd_file *file = iocb->ki_filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    ssize_t retval = 0;
+    size_t copied = 0;
+    size_t base = AESD_BASE_OLDEST;
+    loff_t pos = iocb->ki_pos;
+    size_t count = iov_iter_count(to);
 
-    if (!dev || !buf)
+    if (!dev)
         return -EFAULT;
+    if (pos < 0)
+        return -EINVAL;
 
-    if (mutex_lock_interruptible(&dev->lock))
-        return -ERESTARTSYS;
+again:
+    while (iov_iter_count(to)) {
+        struct aesd_record *record;
+        size_t entry_offset, bytes_avail, n;
+        u32 crc;
 
-    entry = aesd_circular_buffer_find_entry_offset_for_fpos(
-        &dev->circbuf, *f_pos, &entry_offset);
+        record = aesd_find_record(dev, pos, &base, &entry_offset, &crc);
+        if (!record)
+            break;
+
+        // Checksums are verified lazily, the first time a record is read
+        if (!READ_ONCE(record->crc_checked)) {
+            if (aesd_record_crc(record) != crc) {
+                printk(KERN_ERR "aesdchar: checksum mismatch in entry at f_pos %lld\n", pos);
+                aesd_record_put(record);
+                retval = -EIO;
+                break;
+            }
+            WRITE_ONCE(record->crc_checked, true);
+        }
 
-    if (!entry) {
-        // No more data at this f_pos => EOF
-        retval = 0;
-        goto out_unlock;
+        bytes_avail = record->size - entry_offset;
+        n = aesd_record_copy_to_iter(record, entry_offset, to);
+        aesd_record_put(record);
+        copied += n;
+        pos += n;
+        if (n < bytes_avail) {
+            // Destination is full, or faulted part way through
+            if (iov_iter_count(to))
+                retval = -EFAULT;
+            break;
+        }
     }
 
-    bytes_avail = entry->size - entry_offset;
-    to_copy = (count < bytes_avail) ? count : bytes_avail;
+    if (!copied && !retval && file->follow && iov_iter_count(to)) {
+        retval = aesd_wait_for_data(file, (iocb->ki_filp->f_flags & O_NONBLOCK) ||
+                                          (iocb->ki_flags & IOCB_NOWAIT), &pos);
+        if (!retval)
+            goto again;
+    }
 
-    if (copy_to_user(buf, entry->buffptr + entry_offset, to_copy)) {
-        retval = -EFAULT;
-        goto out_unlock;
+    if (copied) {
+        file->stream_pos = base + pos;
+        atomic64_add(copied, &dev->stats.bytes_out);
     }
+    trace_aesdchar_read(dev->index, iocb->ki_pos, count, copied ? copied : retval);
+    iocb->ki_pos = pos;
 
-    *f_pos += to_copy;
-    retval = to_copy;
+    // Report a partial read rather than the error which ended it
+    return copied ? copied : retval;
+}
 
-out_unlock:
-    mutex_unlock(&dev->lock);
-    return retval;
+/*
+ * Publish the completed @record as the newest ring entry, releasing the
+ * oldest entry if the ring is full.  Called with dev->lock held.  The
+ * checksum is computed before entering the write side of dev->seq, keeping
+ * the section readers may spin on short.
+ */
+static void aesd_commit_record(struct aesd_dev *dev, struct aesd_record *record)
+{
+    struct aesd_buffer_entry entry = {
+        .size = record->size,
+        .crc32c = aesd_record_crc(record),
+        .priv = record,
+    };
+    u64 now = ktime_get_real_ns();
+    size_t offs = dev->circbuf.head_offs;
+
+    // Keep timestamps ordered for binary search, even if the clock steps back
+    dev->last_time_ns = max(now, dev->last_time_ns);
+    entry.timestamp = dev->last_time_ns;
+
+    write_seqcount_begin(&dev->seq);
+    // Make room within the byte budget, a larger record is kept alone
+    if (dev->max_bytes)
+        aesd_evict_to_size(dev, dev->max_bytes - min(dev->max_bytes, record->size));
+    if (dev->circbuf.full)
+        aesd_evict_oldest(dev);
+    aesd_circular_buffer_add_entry(&dev->circbuf, &entry);
+    write_seqcount_end(&dev->seq);
+    dev->write_seq++;
+
+    if (dev->mmap)
+        aesd_mmap_publish(dev->mmap, dev->write_seq - 1, offs, record, entry.crc32c,
+                          dev->write_seq - aesd_circular_buffer_count(&dev->circbuf));
 }
 
 /*
- * Write accumulates bytes into dev->working until a '\n' is seen.
- * Each completed command (ending in '\n') is pushed as one entry
- * into the circular buffer. Only last 10 are kept; older freed.
- *
- * We also handle the case where a single write contains multiple
- * newline-terminated commands by splitting them.
+ * Locate entry @index, counting from the oldest, without taking dev->lock.
+ * @return 0 after storing the entry's file position, stream position and
+ * size, or -EINVAL if fewer entries are stored
  */
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
-                   loff_t *f_pos)
+static int aesd_entry_pos(struct aesd_dev *dev, uint32_t index, size_t *fpos,
+                          size_t *stream_pos, size_t *size)
 {
-    struct aesd_dev *dev = filp->private_data;
-    ssize_t retval = -ENOMEM;
-    char *kbuf = NULL;
-    size_t copied = 0;
+    struct aesd_circular_buffer snap;
+    struct aesd_buffer_entry *entry;
+    unsigned int seq;
+    int ret;
+
+    rcu_read_lock();
+    do {
+        ret = -EINVAL;
+        seq = read_seqcount_begin(&dev->seq);
+        aesd_snapshot_ring(dev, &snap);
+        if (read_seqcount_retry(&dev->seq, seq))
+            continue;
+
+        entry = aesd_circular_buffer_get(&snap, index);
+        if (entry) {
+            *size = READ_ONCE(entry->size);
+            *stream_pos = READ_ONCE(entry->offs);
+            *fpos = aesd_circular_buffer_entry_fpos(&snap, entry);
+            ret = 0;
+        }
+    } while (read_seqcount_retry(&dev->seq, seq));
+    rcu_read_unlock();
 
-    PDEBUG("write %zu bytes with offset %lld", count, *f_pos);
+    return ret;
+}
 
-    if (!dev || !buf)
-        return -EFAULT;
+/*
+ * Locate the oldest entry completed at or after @time_ns without taking
+ * dev->lock.  Stores its file position, stream position and timestamp, or
+ * the end of the data and a timestamp of 0 if there is no such entry.
+ */
+static void aesd_time_pos(struct aesd_dev *dev, u64 time_ns, size_t *fpos,
+                          size_t *stream_pos, u64 *entry_time_ns)
+{
+    struct aesd_circular_buffer snap;
+    struct aesd_buffer_entry *entry;
+    unsigned int seq;
+
+    rcu_read_lock();
+    do {
+        seq = read_seqcount_begin(&dev->seq);
+        aesd_snapshot_ring(dev, &snap);
+        if (read_seqcount_retry(&dev->seq, seq))
+            continue;
+
+        entry = aesd_circular_buffer_find_entry_for_time(&snap, time_ns);
+        if (entry) {
+            *entry_time_ns = READ_ONCE(entry->timestamp);
+            *stream_pos = READ_ONCE(entry->offs);
+            *fpos = aesd_circular_buffer_entry_fpos(&snap, entry);
+        } else {
+            *entry_time_ns = 0;
+            *stream_pos = snap.head_offs;
+            *fpos = aesd_circular_buffer_size(&snap);
+        }
+    } while (read_seqcount_retry(&dev->seq, seq));
+    rcu_read_unlock();
+}
 
-    if (mutex_lock_interruptible(&dev->lock))
-        return -ERESTARTSYS;
+/*
+ * Write accumulates bytes into the working record of the file until a '\n'
+ * is seen.  Each completed command (ending in '\n') is pushed as one entry
+ * into the circular buffer, evicting the oldest one when it is full.  Only
+ * that push takes dev->lock, so writers on different files proceed in
+ * parallel and their commands never interleave.
+ *
+ * The user buffers are copied once, into blocks which the records they
+ * complete reference directly, so a write or writev containing multiple
+ * newline-terminated commands is split without further copies, and all of
+ * them are committed under a single acquisition of dev->lock.  Writes
+ * larger than a page are spread over a chain of page sized blocks.
+ *
+ * With a byte budget set, a command which would grow past it fails with
+ * -EFBIG and its bytes so far are discarded, so unterminated commands cannot
+ * hold more kernel memory than committed ones.  Bytes of this write which
+ * belonged to it are not counted as written.
+ */
+ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct aesd_file *file = iocb->ki_filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    struct aesd_block *blocks, *block;
+    size_t count = iov_iter_count(from);
+    ssize_t retval = 0;
+    size_t consumed = 0;
+    // Bytes of this write in file->working, not yet committed
+    size_t pending = 0;
+    unsigned int committed = 0;
+    bool locked = false;
 
-    kbuf = kmalloc(count, GFP_KERNEL);
-    if (!kbuf) {
-        retval = -ENOMEM;
-        goto out_unlock;
+    if (!dev)
+        return -EFAULT;
+    if (!count)
+        return 0;
+
+    // Copy outside of the lock, readers need not wait for user memory
+    blocks = aesd_block_chain_from_iter(from);
+    if (IS_ERR(blocks)) {
+        retval = PTR_ERR(blocks);
+        if (retval == -ENOMEM)
+            atomic64_inc(&dev->stats.enomem);
+        trace_aesdchar_write(dev->index, count, retval, 0);
+        return retval;
     }
 
-    if (copy_from_user(kbuf, buf, count)) {
-        retval = -EFAULT;
-        goto out_free;
+    if (mutex_lock_interruptible(&file->write_lock)) {
+        aesd_block_chain_put(blocks);
+        return -ERESTARTSYS;
     }
 
-    /*
-     * Process possibly multiple commands within this single write:
-     * Append into dev->working, and when we encounter '\n',
-     * push current working buffer as a completed entry.
-     */
-    {
+    for (block = blocks; block; block = block->next) {
         size_t start = 0;
-        while (start < count) {
-            char *nl = memchr(kbuf + start, '\n', count - start);
-            size_t chunk_len = nl ? (size_t)(nl - (kbuf + start) + 1)
-                                  : (count - start);
-
-            // Grow working buffer to hold current chunk
-            {
-                size_t new_size = dev->working.size + chunk_len;
-                char *new_ptr = krealloc((void *)dev->working.buffptr,
-                                         new_size, GFP_KERNEL);
-                if (!new_ptr) {
+
+        while (start < block->len) {
+            char *nl = memchr(block->data + start, '\n', block->len - start);
+            size_t chunk_len = nl ? (size_t)(nl - (block->data + start) + 1)
+                                  : (block->len - start);
+            size_t limit;
+
+            if (!file->working && READ_ONCE(dev->orphan)) {
+                if (!locked)
+                    aesd_lock(dev);
+                locked = true;
+                file->working = dev->orphan;
+                dev->orphan = NULL;
+            }
+
+            if (!file->working) {
+                file->working = aesd_record_alloc();
+                if (!file->working) {
                     retval = -ENOMEM;
-                    goto out_free;
+                    goto out_unlock;
                 }
-                memcpy(new_ptr + dev->working.size, kbuf + start, chunk_len);
-                dev->working.buffptr = new_ptr;
-                dev->working.size = new_size;
             }
 
-            start += chunk_len;
-            copied += chunk_len;
+            // A command may not outgrow the byte budget before it is committed either
+            limit = READ_ONCE(dev->max_bytes);
+            if (limit && file->working->size + chunk_len > limit) {
+                aesd_record_put(file->working);
+                file->working = NULL;
+                consumed -= pending;
+                retval = -EFBIG;
+                goto out_unlock;
+            }
 
+            if (aesd_record_append(file->working, block, block->data + start, chunk_len)) {
+                retval = -ENOMEM;
+                goto out_unlock;
+            }
+            start += chunk_len;
+            consumed += chunk_len;
+            pending += chunk_len;
 
             if (nl) {
-                // If buffer is full, we will overwrite the oldest entry
-                if (dev->circbuf.full) {
-                    struct aesd_buffer_entry *oldest =
-                        &dev->circbuf.entry[dev->circbuf.out_offs];
-
-                    if (oldest->buffptr) {
-                        kfree(oldest->buffptr);
-                    }
-                }
+                // Held until the end of the write, it may complete more commands
+                if (!locked)
+                    aesd_lock(dev);
+                locked = true;
+                aesd_commit_record(dev, file->working);
+                file->working = NULL;
+                pending = 0;
+                committed++;
+            }
+        }
+    }
 
-                // Add the new entry
-                aesd_circular_buffer_add_entry(&dev->circbuf, &dev->working);
+out_unlock:
+    if (locked)
+        mutex_unlock(&dev->lock);
+    mutex_unlock(&file->write_lock);
+    aesd_block_chain_put(blocks);
 
-                // Reset working for the next potential command
-                dev->working.buffptr = NULL;
-                dev->working.size = 0;
-            }
+    if (committed)
+        wake_up_interruptible_poll(&dev->wq, EPOLLIN | EPOLLRDNORM);
+
+    atomic64_add(consumed, &dev->stats.bytes_in);
+    if (retval == -ENOMEM)
+        atomic64_inc(&dev->stats.enomem);
+    trace_aesdchar_write(dev->index, count, consumed ? consumed : retval, committed);
+
+    // Report bytes consumed from this write, if any were
+    return consumed ? consumed : retval;
+}
+
+/*
+ * Seek within the bytes currently stored, SEEK_END being the end of the newest
+ * record.  The size comes from the stream positions kept by the ring, so
+ * seeking costs the same whatever the number of entries.
+ */
+static loff_t aesd_llseek(struct file *filp, loff_t offset, int whence)
+{
+    struct aesd_file *file = filp->private_data;
+    size_t oldest, head;
+    loff_t pos;
+
+    aesd_stream_bounds(file->dev, &oldest, &head);
+
+    switch (whence) {
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = filp->f_pos + offset;
+        break;
+    case SEEK_END:
+        pos = (loff_t)(head - oldest) + offset;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    if (pos < 0 || pos > (loff_t)(head - oldest))
+        return -EINVAL;
+
+    filp->f_pos = pos;
+    file->stream_pos = oldest + pos;
+    return pos;
+}
+
+/*
+ * Readable when a read would return data or, for files which are not
+ * following, 0 without waiting.  Writes never wait.
+ */
+static __poll_t aesd_poll(struct file *filp, poll_table *wait)
+{
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+    size_t oldest, head;
+
+    poll_wait(filp, &dev->wq, wait);
+
+    aesd_stream_bounds(dev, &oldest, &head);
+    if (!file->follow || filp->f_pos < head - oldest || file->stream_pos != head)
+        mask |= EPOLLIN | EPOLLRDNORM;
+    return mask;
+}
+
+/*
+ * Create dev->mmap and copy the records already stored into it.  Called with
+ * dev->lock held.
+ */
+static int aesd_mmap_setup(struct aesd_dev *dev)
+{
+    uint32_t count = aesd_circular_buffer_count(&dev->circbuf);
+    u64 oldest_seq = dev->write_seq - count;
+    struct aesd_mmap_area *area;
+    uint32_t i;
+
+    area = aesd_mmap_area_create(mmap_size, oldest_seq,
+                                 dev->circbuf.head_offs - aesd_circular_buffer_size(&dev->circbuf));
+    if (!area) {
+        atomic64_inc(&dev->stats.enomem);
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < count; i++) {
+        struct aesd_buffer_entry *entry = aesd_circular_buffer_get(&dev->circbuf, i);
+
+        aesd_mmap_publish(area, oldest_seq + i, entry->offs, entry->priv,
+                          entry->crc32c, oldest_seq);
+    }
+
+    dev->mmap = area;
+    return 0;
+}
+
+/*
+ * Map the records read-only, see struct aesd_mmap_header.  The area is created
+ * on first use, so devices which are never mapped pay nothing for it.
+ */
+static int aesd_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    int retval = 0;
+
+    if (!mmap_size)
+        return -ENODEV;
+
+    if (aesd_lock_interruptible(dev))
+        return -ERESTARTSYS;
+    if (!dev->mmap)
+        retval = aesd_mmap_setup(dev);
+    mutex_unlock(&dev->lock);
+
+    if (retval)
+        return retval;
+    return aesd_mmap_map(dev->mmap, vma);
+}
+
+/*
+ * Handle AESDCHAR_IOCGETINFO.  Holding dev->lock keeps writers out while the
+ * entries are copied, so sizes, offsets and totals all describe the same ring.
+ */
+static long aesd_get_info(struct aesd_dev *dev, struct aesd_ring_info __user *uinfo)
+{
+    struct aesd_entry_info *entries = NULL;
+    struct aesd_ring_info info;
+    uint32_t n, i;
+    long retval = 0;
+
+    if (copy_from_user(&info, uinfo, sizeof(info)))
+        return -EFAULT;
+
+    n = info.entries ? min_t(uint32_t, info.max_entries, AESDCHAR_MAX_RING_CAPACITY) : 0;
+    if (n) {
+        entries = kvmalloc_array(n, sizeof(*entries), GFP_KERNEL);
+        if (!entries) {
+            atomic64_inc(&dev->stats.enomem);
+            return -ENOMEM;
         }
     }
 
-    retval = copied; // report bytes consumed from this write
+    if (aesd_lock_interruptible(dev)) {
+        kvfree(entries);
+        return -ERESTARTSYS;
+    }
 
-out_free:
-    kfree(kbuf);
-out_unlock:
+    info.count = aesd_circular_buffer_count(&dev->circbuf);
+    info.total_size = aesd_circular_buffer_size(&dev->circbuf);
+    info.head_offs = dev->circbuf.head_offs;
+    info.write_seq = dev->write_seq;
+    n = min(n, info.count);
+    for (i = 0; i < n; i++) {
+        struct aesd_buffer_entry *entry = aesd_circular_buffer_get(&dev->circbuf, i);
+
+        entries[i].offs = entry->offs;
+        entries[i].size = entry->size;
+        entries[i].time_ns = entry->timestamp;
+    }
     mutex_unlock(&dev->lock);
+
+    if (n && copy_to_user(u64_to_user_ptr(info.entries), entries, n * sizeof(*entries)))
+        retval = -EFAULT;
+    else if (copy_to_user(uinfo, &info, sizeof(info)))
+        retval = -EFAULT;
+
+    kvfree(entries);
     return retval;
 }
 
 long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
-    struct aesd_dev *dev = filp->private_data;
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
     struct aesd_seekto seekto;
+    struct aesd_seektime seektime;
+    uint32_t capacity, follow;
     long retval = 0;
-    uint8_t index;
-    struct aesd_buffer_entry *entry;
     size_t char_offset = 0;
-    size_t current_offset = 0;
-
-    PDEBUG("ioctl cmd=%u", cmd);
+    size_t entry_size = 0;
+    size_t stream_pos = 0;
 
     if (!dev)
         return -EFAULT;
@@ -228,59 +836,62 @@ long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
             break;
         }
 
-        if (mutex_lock_interruptible(&dev->lock)) {
-            retval = -ERESTARTSYS;
+        // Entries are numbered from the oldest one still stored
+        if (aesd_entry_pos(dev, seekto.write_cmd, &char_offset, &stream_pos, &entry_size) ||
+            entry_size == 0) {
+            retval = -EINVAL;
             break;
         }
 
-        // Validate write_cmd is within bounds
-        if (seekto.write_cmd >= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) {
+        // Check if write_cmd_offset is within this entry
+        if (seekto.write_cmd_offset >= entry_size) {
             retval = -EINVAL;
-            goto unlock;
+            break;
         }
 
-        // Calculate the absolute character offset
-        // First, find the entry corresponding to write_cmd
-        index = 0;
-        AESD_CIRCULAR_BUFFER_FOREACH(entry, &dev->circbuf, index) {
-            if (index == seekto.write_cmd) {
-                // Check if this entry exists and has data
-                if (!entry->buffptr || entry->size == 0) {
-                    retval = -EINVAL;
-                    goto unlock;
-                }
-                
-                // Check if write_cmd_offset is within this entry
-                if (seekto.write_cmd_offset >= entry->size) {
-                    retval = -EINVAL;
-                    goto unlock;
-                }
-                
-                // Calculate absolute offset
-                char_offset = current_offset + seekto.write_cmd_offset;
-                break;
-            }
-            
-            // Only count entries that have data
-            if (entry->buffptr && entry->size > 0) {
-                current_offset += entry->size;
-            }
+        char_offset += seekto.write_cmd_offset;
+
+        // Set the file position
+        filp->f_pos = char_offset;
+        file->stream_pos = stream_pos + seekto.write_cmd_offset;
+        break;
+
+    case AESDCHAR_IOCRESIZE:
+        if (copy_from_user(&capacity, (void __user *)arg, sizeof(capacity))) {
+            retval = -EFAULT;
+            break;
         }
+        retval = aesd_resize(dev, capacity);
+        break;
 
-        // If we didn't find the entry, it's invalid
-        if (index >= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) {
-            retval = -EINVAL;
-            goto unlock;
+    case AESDCHAR_IOCFOLLOW:
+        if (copy_from_user(&follow, (void __user *)arg, sizeof(follow))) {
+            retval = -EFAULT;
+            break;
         }
+        file->follow = follow != 0;
+        break;
 
-        // Set the file position
-        filp->f_pos = char_offset;
-        
-        PDEBUG("ioctl seek to write_cmd=%u, write_cmd_offset=%u, f_pos=%lld",
-               seekto.write_cmd, seekto.write_cmd_offset, filp->f_pos);
+    case AESDCHAR_IOCGETINFO:
+        retval = aesd_get_info(dev, (struct aesd_ring_info __user *)arg);
+        break;
 
-unlock:
-        mutex_unlock(&dev->lock);
+    case AESDCHAR_IOCSEEKTIME:
+        if (copy_from_user(&seektime, (void __user *)arg, sizeof(seektime))) {
+            retval = -EFAULT;
+            break;
+        }
+
+        aesd_time_pos(dev, seektime.time_ns, &char_offset, &stream_pos,
+                      &seektime.entry_time_ns);
+        seektime.pos = char_offset;
+        if (copy_to_user((void __user *)arg, &seektime, sizeof(seektime))) {
+            retval = -EFAULT;
+            break;
+        }
+
+        filp->f_pos = char_offset;
+        file->stream_pos = stream_pos;
         break;
 
     default:
@@ -288,73 +899,282 @@ unlock:
         break;
     }
 
+    trace_aesdchar_ioctl(dev->index, cmd, retval);
     return retval;
 }
 
 
 struct file_operations aesd_fops = {
     .owner          = THIS_MODULE,
-    .read           = aesd_read,
-    .write          = aesd_write,
+    .llseek         = aesd_llseek,
+    .read_iter      = aesd_read_iter,
+    .write_iter     = aesd_write_iter,
     .open           = aesd_open,
     .release        = aesd_release,
+    .poll           = aesd_poll,
+    .mmap           = aesd_mmap,
     .unlocked_ioctl = aesd_ioctl,  // Add this line
 };
 
+static ssize_t bytes_used_show(struct device *device, struct device_attribute *attr,
+                               char *buf)
+{
+    struct aesd_dev *dev = dev_get_drvdata(device);
+    size_t used;
+
+    aesd_lock(dev);
+    used = aesd_circular_buffer_size(&dev->circbuf);
+    mutex_unlock(&dev->lock);
+    return sysfs_emit(buf, "%zu\n", used);
+}
+static DEVICE_ATTR_RO(bytes_used);
+
+static ssize_t max_bytes_show(struct device *device, struct device_attribute *attr,
+                              char *buf)
+{
+    struct aesd_dev *dev = dev_get_drvdata(device);
+
+    return sysfs_emit(buf, "%zu\n", READ_ONCE(dev->max_bytes));
+}
+
+/*
+ * Set the byte budget of the device, evicting the oldest entries right away
+ * if it shrinks below the bytes stored
+ */
+static ssize_t max_bytes_store(struct device *device, struct device_attribute *attr,
+                               const char *buf, size_t count)
+{
+    struct aesd_dev *dev = dev_get_drvdata(device);
+    unsigned long limit;
+    int err;
+
+    err = kstrtoul(buf, 0, &limit);
+    if (err)
+        return err;
+
+    if (aesd_lock_interruptible(dev))
+        return -ERESTARTSYS;
+    dev->max_bytes = limit;
+    if (limit && aesd_circular_buffer_size(&dev->circbuf) > limit) {
+        write_seqcount_begin(&dev->seq);
+        aesd_evict_to_size(dev, limit);
+        write_seqcount_end(&dev->seq);
+        if (dev->mmap)
+            aesd_mmap_trim(dev->mmap,
+                           dev->write_seq - aesd_circular_buffer_count(&dev->circbuf));
+    }
+    mutex_unlock(&dev->lock);
+    return count;
+}
+static DEVICE_ATTR_RW(max_bytes);
+
+static ssize_t records_written_show(struct device *device, struct device_attribute *attr,
+                                    char *buf)
+{
+    struct aesd_dev *dev = dev_get_drvdata(device);
+
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(dev->write_seq));
+}
+static DEVICE_ATTR_RO(records_written);
+
+#define AESD_STAT_ATTR(_name)                                                        \
+static ssize_t _name##_show(struct device *device, struct device_attribute *attr,    \
+                            char *buf)                                               \
+{                                                                                    \
+    struct aesd_dev *dev = dev_get_drvdata(device);                                  \
+                                                                                     \
+    return sysfs_emit(buf, "%lld\n", atomic64_read(&dev->stats._name));              \
+}                                                                                    \
+static DEVICE_ATTR_RO(_name)
+
+AESD_STAT_ATTR(bytes_in);
+AESD_STAT_ATTR(bytes_out);
+AESD_STAT_ATTR(evictions);
+AESD_STAT_ATTR(lock_wait_ns);
+AESD_STAT_ATTR(enomem);
+
+static struct attribute *aesd_attrs[] = {
+    &dev_attr_bytes_used.attr,
+    &dev_attr_max_bytes.attr,
+    NULL,
+};
+
+static const struct attribute_group aesd_group = {
+    .attrs = aesd_attrs,
+};
+
+// Counters since the module was loaded, under /sys/class/aesdchar/aesdchar<index>/stats
+static struct attribute *aesd_stats_attrs[] = {
+    &dev_attr_records_written.attr,
+    &dev_attr_bytes_in.attr,
+    &dev_attr_bytes_out.attr,
+    &dev_attr_evictions.attr,
+    &dev_attr_lock_wait_ns.attr,
+    &dev_attr_enomem.attr,
+    NULL,
+};
+
+static const struct attribute_group aesd_stats_group = {
+    .name = "stats",
+    .attrs = aesd_stats_attrs,
+};
+
+static const struct attribute_group *aesd_groups[] = {
+    &aesd_group,
+    &aesd_stats_group,
+    NULL,
+};
+
 static int aesd_setup_cdev(struct aesd_dev *dev)
 {
-    int err, devno = MKDEV(aesd_major, aesd_minor);
+    int err, devno = MKDEV(aesd_major, aesd_minor + dev->index);
 
     cdev_init(&dev->cdev, &aesd_fops);
     dev->cdev.owner = THIS_MODULE;
     dev->cdev.ops = &aesd_fops;
     err = cdev_add(&dev->cdev, devno, 1);
     if (err)
-        printk(KERN_ERR "Error %d adding aesd cdev", err);
+        printk(KERN_ERR "Error %d adding aesd cdev %u", err, dev->index);
     return err;
 }
 
+/*
+ * Set up the ring of device @index and make it available to user space
+ */
+static int aesd_dev_init(struct aesd_dev *dev, unsigned int index)
+{
+    struct aesd_buffer_entry *entries;
+    int result;
+
+    entries = kvcalloc(ring_capacity, sizeof(*entries), GFP_KERNEL);
+    if (!entries)
+        return -ENOMEM;
+
+    dev->index = index;
+    dev->max_bytes = max_bytes;
+    aesd_circular_buffer_init_storage(&dev->circbuf, entries, ring_capacity);
+    dev->orphan = NULL;
+    mutex_init(&dev->lock);
+    seqcount_mutex_init(&dev->seq, &dev->lock);
+    init_waitqueue_head(&dev->wq);
+
+    result = aesd_setup_cdev(dev);
+    if (result) {
+        kvfree(entries);
+        return result;
+    }
+
+    // Attributes under /sys/class/aesdchar/aesdchar<index>
+    dev->device = device_create(aesd_class, NULL, dev->cdev.dev, dev, "aesdchar%u", index);
+    if (IS_ERR(dev->device)) {
+        result = PTR_ERR(dev->device);
+        cdev_del(&dev->cdev);
+        kvfree(entries);
+    }
+    return result;
+}
+
+static void aesd_dev_destroy(struct aesd_dev *dev)
+{
+    device_destroy(aesd_class, dev->cdev.dev);
+    cdev_del(&dev->cdev);
+
+    // Free the orphaned record (unterminated command, if any)
+    aesd_record_put(dev->orphan);
+
+    // Free all stored entries in the ring
+    free_all_entries(&dev->circbuf);
+    kvfree(dev->circbuf.entry);
+    aesd_mmap_area_destroy(dev->mmap);
+}
+
 int aesd_init_module(void)
 {
     dev_t dev = 0;
+    unsigned int i;
     int result;
 
-    result = alloc_chrdev_region(&dev, aesd_minor, 1, "aesdchar");
+    if (nr_devs == 0 || nr_devs > AESD_MAX_DEVS) {
+        printk(KERN_WARNING "aesdchar: invalid nr_devs %u\n", nr_devs);
+        return -EINVAL;
+    }
+
+    if (ring_capacity == 0 || ring_capacity > AESDCHAR_MAX_RING_CAPACITY) {
+        printk(KERN_WARNING "aesdchar: invalid ring_capacity %u\n", ring_capacity);
+        return -EINVAL;
+    }
+
+    if (mmap_size > AESD_MAX_MMAP_SIZE) {
+        printk(KERN_WARNING "aesdchar: invalid mmap_size %u\n", mmap_size);
+        return -EINVAL;
+    }
+    mmap_size = PAGE_ALIGN(mmap_size);
+
+    result = alloc_chrdev_region(&dev, aesd_minor, nr_devs, "aesdchar");
     aesd_major = MAJOR(dev);
     if (result < 0) {
         printk(KERN_WARNING "Can't get major %d\n", aesd_major);
         return result;
     }
 
-    memset(&aesd_device, 0, sizeof(struct aesd_dev));
+    aesd_devices = kcalloc(nr_devs, sizeof(*aesd_devices), GFP_KERNEL);
+    if (!aesd_devices) {
+        result = -ENOMEM;
+        goto fail_region;
+    }
+
+    result = aesd_record_pools_init();
+    if (result)
+        goto fail_devices;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+    aesd_class = class_create("aesdchar");
+#else
+    aesd_class = class_create(THIS_MODULE, "aesdchar");
+#endif
+    if (IS_ERR(aesd_class)) {
+        result = PTR_ERR(aesd_class);
+        goto fail_pools;
+    }
+    aesd_class->dev_groups = aesd_groups;
 
     // AESD-specific init
-    aesd_circular_buffer_init(&aesd_device.circbuf);
-    aesd_device.working.buffptr = NULL;
-    aesd_device.working.size = 0;
-    mutex_init(&aesd_device.lock);
+    for (i = 0; i < nr_devs; i++) {
+        result = aesd_dev_init(&aesd_devices[i], i);
+        if (result)
+            goto fail_cdevs;
+    }
 
-    result = aesd_setup_cdev(&aesd_device);
-    if (result)
-        unregister_chrdev_region(dev, 1);
+    return 0;
 
+fail_cdevs:
+    while (i--)
+        aesd_dev_destroy(&aesd_devices[i]);
+    class_destroy(aesd_class);
+fail_pools:
+    rcu_barrier();
+    aesd_record_pools_destroy();
+fail_devices:
+    kfree(aesd_devices);
+fail_region:
+    unregister_chrdev_region(dev, nr_devs);
     return result;
 }
 
 void aesd_cleanup_module(void)
 {
     dev_t devno = MKDEV(aesd_major, aesd_minor);
+    unsigned int i;
 
-    cdev_del(&aesd_device.cdev);
-
-    // Free working buffer (unterminated command, if any)
-    if (aesd_device.working.buffptr)
-        kfree((void *)aesd_device.working.buffptr);
-
-    // Free all stored entries in the ring
-    free_all_entries(&aesd_device.circbuf);
+    for (i = 0; i < nr_devs; i++)
+        aesd_dev_destroy(&aesd_devices[i]);
+    class_destroy(aesd_class);
+    // Let deferred record frees finish before their caches go away
+    rcu_barrier();
+    aesd_record_pools_destroy();
+    kfree(aesd_devices);
 
-    unregister_chrdev_region(devno, 1);
+    unregister_chrdev_region(devno, nr_devs);
 }
 
 module_init(aesd_init_module);
@@ -0,0 +1,290 @@
+/**
+ * @file aesd-shim.c
+ * @brief User space stand-ins for the kernel interfaces used by the aesdchar driver
+ *
+ * See aesd-shim.h for details.
+ */
+
+#include "aesd-shim.h"
+#include "../aesdchar.h"
+#include "../../server/aesd-crc32c.h"
+
+/*
+ * RCU: call_rcu() queues the callback, a helper thread runs the queue after
+ * waiting for the readers present at that time.  Callbacks never run in the
+ * caller's context, as the driver may queue them inside seqcount write
+ * sections readers are spinning on.
+ */
+pthread_rwlock_t aesd_shim_rcu_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t rcu_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t rcu_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t rcu_thread_once = PTHREAD_ONCE_INIT;
+static struct rcu_head *rcu_queue;
+
+void rcu_barrier(void)
+{
+    struct rcu_head *head, *next;
+
+    pthread_mutex_lock(&rcu_drain_lock);
+    pthread_mutex_lock(&rcu_queue_lock);
+    head = rcu_queue;
+    rcu_queue = NULL;
+    pthread_mutex_unlock(&rcu_queue_lock);
+
+    if (head)
+        synchronize_rcu();
+    for (; head; head = next) {
+        next = head->next;
+        head->func(head);
+    }
+    pthread_mutex_unlock(&rcu_drain_lock);
+}
+
+static void *rcu_thread(void *arg)
+{
+    for (;;) {
+        usleep(1000);
+        rcu_barrier();
+    }
+    return arg;
+}
+
+static void rcu_thread_start(void)
+{
+    pthread_t thread;
+
+    pthread_create(&thread, NULL, rcu_thread, NULL);
+    pthread_detach(thread);
+}
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *))
+{
+    pthread_once(&rcu_thread_once, rcu_thread_start);
+    head->func = func;
+    pthread_mutex_lock(&rcu_queue_lock);
+    head->next = rcu_queue;
+    rcu_queue = head;
+    pthread_mutex_unlock(&rcu_queue_lock);
+}
+
+u32 crc32c(u32 crc, const void *data, unsigned int len)
+{
+    // aesd_crc32c() applies the standard inversions, the kernel's crc32c() does not
+    return ~aesd_crc32c(~crc, data, len);
+}
+
+struct page *alloc_page(gfp_t f)
+{
+    struct page *page = malloc(sizeof(*page));
+
+    if (!page)
+        return NULL;
+    page->fd = memfd_create("aesd-shim-page", 0);
+    if (page->fd < 0 || ftruncate(page->fd, PAGE_SIZE) < 0) {
+        if (page->fd >= 0)
+            close(page->fd);
+        free(page);
+        return NULL;
+    }
+    return page;
+}
+
+void __free_page(struct page *page)
+{
+    close(page->fd);
+    free(page);
+}
+
+static void *map_pages(struct page **pages, unsigned long count, int prot)
+{
+    char *base = mmap(NULL, count * PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    unsigned long i;
+
+    if (base == MAP_FAILED)
+        return NULL;
+    for (i = 0; i < count; i++) {
+        if (mmap(base + i * PAGE_SIZE, PAGE_SIZE, prot, MAP_SHARED | MAP_FIXED,
+                 pages[i]->fd, 0) == MAP_FAILED) {
+            munmap(base, count * PAGE_SIZE);
+            return NULL;
+        }
+    }
+    return base;
+}
+
+void *vmap(struct page **pages, unsigned int count, unsigned long flags, int prot)
+{
+    return map_pages(pages, count, PROT_READ | PROT_WRITE);
+}
+
+void vunmap(const void *addr)
+{
+    // The size is not known here, the mapping lives until the program exits
+}
+
+int vm_map_pages(struct vm_area_struct *vma, struct page **pages, unsigned long num)
+{
+    vma->vm_start = map_pages(pages, num, PROT_READ);
+    return vma->vm_start ? 0 : -ENOMEM;
+}
+
+static size_t iter_copy(void *kaddr, size_t bytes, struct iov_iter *i, bool to_iter)
+{
+    size_t done = 0;
+
+    while (bytes && i->count && i->nr_segs) {
+        size_t n = min(i->iov->iov_len - i->iov_offset, bytes);
+        char *user = (char *)i->iov->iov_base + i->iov_offset;
+
+        if (to_iter)
+            memcpy(user, (char *)kaddr + done, n);
+        else
+            memcpy((char *)kaddr + done, user, n);
+        done += n;
+        bytes -= n;
+        i->count -= n;
+        i->iov_offset += n;
+        if (i->iov_offset == i->iov->iov_len) {
+            i->iov++;
+            i->nr_segs--;
+            i->iov_offset = 0;
+        }
+    }
+    return done;
+}
+
+size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i)
+{
+    return iter_copy((void *)addr, bytes, i, true);
+}
+
+size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *i)
+{
+    return iter_copy(addr, bytes, i, false);
+}
+
+int kstrtoul(const char *s, unsigned int base, unsigned long *res)
+{
+    char *end;
+
+    errno = 0;
+    *res = strtoul(s, &end, base);
+    if (end == s || errno || (*end && strcmp(end, "\n") != 0))
+        return -EINVAL;
+    return 0;
+}
+
+static struct class *shim_class;
+
+struct class *class_create(const char *name)
+{
+    shim_class = calloc(1, sizeof(*shim_class));
+    return shim_class ? shim_class : ERR_PTR(-ENOMEM);
+}
+
+void class_destroy(struct class *cls)
+{
+    free(cls);
+    shim_class = NULL;
+}
+
+struct device *device_create(struct class *cls, struct device *parent, dev_t devt,
+                             void *drvdata, const char *fmt, ...)
+{
+    struct device *dev;
+
+    if (MINOR(devt) >= AESD_SHIM_MAX_DEVICES)
+        return ERR_PTR(-EINVAL);
+    dev = calloc(1, sizeof(*dev));
+    if (!dev)
+        return ERR_PTR(-ENOMEM);
+    dev->drvdata = drvdata;
+    cls->devices[MINOR(devt)] = dev;
+    return dev;
+}
+
+void device_destroy(struct class *cls, dev_t devt)
+{
+    free(cls->devices[MINOR(devt)]);
+    cls->devices[MINOR(devt)] = NULL;
+}
+
+ssize_t aesd_shim_sysfs(unsigned int minor, const char *name, const char *in, char *out)
+{
+    const struct attribute_group **group;
+    struct attribute **attr;
+    struct device *dev;
+
+    if (!shim_class || minor >= AESD_SHIM_MAX_DEVICES || !shim_class->devices[minor])
+        return -ENODEV;
+    dev = shim_class->devices[minor];
+
+    for (group = shim_class->dev_groups; *group; group++) {
+        for (attr = (*group)->attrs; *attr; attr++) {
+            struct device_attribute *da = (struct device_attribute *)*attr;
+
+            if (strcmp((*attr)->name, name) != 0)
+                continue;
+            if (in)
+                return da->store ? da->store(dev, da, in, strlen(in)) : -EACCES;
+            return da->show(dev, da, out);
+        }
+    }
+    return -ENOENT;
+}
+
+int aesd_shim_open(struct inode *inode, struct file *filp, unsigned int minor,
+                   unsigned int flags)
+{
+    if (!shim_class || minor >= AESD_SHIM_MAX_DEVICES || !shim_class->devices[minor])
+        return -ENODEV;
+
+    memset(filp, 0, sizeof(*filp));
+    filp->f_flags = flags;
+    inode->i_cdev = &((struct aesd_dev *)shim_class->devices[minor]->drvdata)->cdev;
+    return aesd_fops.open(inode, filp);
+}
+
+void aesd_shim_close(struct inode *inode, struct file *filp)
+{
+    aesd_fops.release(inode, filp);
+}
+
+ssize_t aesd_shim_pread(struct file *filp, void *buf, size_t count, loff_t pos)
+{
+    struct iovec iov = { buf, count };
+    struct iov_iter iter = { &iov, 1, 0, count };
+    struct kiocb iocb = { filp, pos, 0 };
+
+    return aesd_fops.read_iter(&iocb, &iter);
+}
+
+ssize_t aesd_shim_read(struct file *filp, void *buf, size_t count)
+{
+    struct iovec iov = { buf, count };
+    struct iov_iter iter = { &iov, 1, 0, count };
+    struct kiocb iocb = { filp, filp->f_pos, 0 };
+    ssize_t ret = aesd_fops.read_iter(&iocb, &iter);
+
+    if (ret > 0)
+        filp->f_pos = iocb.ki_pos;
+    return ret;
+}
+
+ssize_t aesd_shim_writev(struct file *filp, const struct iovec *iov, unsigned long nr)
+{
+    struct iov_iter iter = { iov, nr, 0, 0 };
+    struct kiocb iocb = { filp, filp->f_pos, 0 };
+    unsigned long i;
+
+    for (i = 0; i < nr; i++)
+        iter.count += iov[i].iov_len;
+    return aesd_fops.write_iter(&iocb, &iter);
+}
+
+ssize_t aesd_shim_write(struct file *filp, const void *buf, size_t count)
+{
+    struct iovec iov = { (void *)buf, count };
+
+    return aesd_shim_writev(filp, &iov, 1);
+}
@@ -0,0 +1,486 @@
+/*
+ * aesd-shim.h
+ *
+ *  @brief User space stand-ins for the kernel interfaces used by the aesdchar driver
+ *
+ *  Lets main.c, aesd-record.c, aesd-mmap.c and aesd-circular-buffer.c be built
+ *  unchanged into a user space program, for benchmarks and tests on hosts
+ *  which cannot load the module.  Build them with -D__KERNEL__ and this
+ *  directory first on the include path: the headers under linux/ and trace/
+ *  all resolve to this file.
+ *
+ *  The stand-ins keep the semantics the driver relies on, not the kernel's
+ *  performance characteristics:
+ *  - allocations go to malloc, user copies are memcpy
+ *  - mutexes are pthread mutexes, and are never interrupted
+ *  - RCU readers share a global rwlock, call_rcu() callbacks run on a helper
+ *    thread after every reader present when they were queued has left
+ *  - pages are memfd backed, so vmap() can map the same page twice
+ *  - tracepoints compile to nothing, sysfs attributes are reached through
+ *    aesd_shim_sysfs()
+ */
+
+#ifndef AESD_SHIM_H
+#define AESD_SHIM_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <asm-generic/ioctl.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int32_t s32;
+typedef int64_t s64;
+
+#define loff_t long long
+#define __user
+#define __init
+#define __exit
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define ERESTARTSYS 512
+
+#define KERN_ERR "<3>"
+#define KERN_WARNING "<4>"
+#define KERN_INFO "<6>"
+#define KERN_DEBUG "<7>"
+// Define AESD_SHIM_VERBOSE to see the driver's printk output
+#ifdef AESD_SHIM_VERBOSE
+#define printk(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+#else
+#define printk(fmt, ...) ((void)0)
+#endif
+
+#define MODULE_AUTHOR(x)
+#define MODULE_LICENSE(x)
+#define MODULE_PARM_DESC(a, b)
+#define module_param(name, type, perm)
+// The module's init and exit functions become aesd_shim_module_init/exit
+#define module_init(fn) int aesd_shim_module_init(void) { return fn(); }
+#define module_exit(fn) void aesd_shim_module_exit(void) { fn(); }
+#define THIS_MODULE NULL
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b) ((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define READ_ONCE(x) (*(volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v) (*(volatile __typeof__(x) *)&(x) = (v))
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+
+#define LINUX_VERSION_CODE KERNEL_VERSION(6, 8, 0)
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+
+/* err.h */
+#define MAX_ERRNO 4095
+static inline void *ERR_PTR(long error) { return (void *)error; }
+static inline long PTR_ERR(const void *ptr) { return (long)ptr; }
+static inline bool IS_ERR(const void *ptr)
+{
+    return (unsigned long)ptr >= (unsigned long)-MAX_ERRNO;
+}
+
+/* slab.h */
+typedef unsigned int gfp_t;
+#define GFP_KERNEL 0u
+#define __GFP_ZERO 1u
+#define __GFP_NOWARN 2u
+#define SLAB_HWCACHE_ALIGN 1u
+#define SLAB_ACCOUNT 2u
+
+static inline void *kmalloc(size_t n, gfp_t f)
+{
+    return (f & __GFP_ZERO) ? calloc(1, n ? n : 1) : malloc(n ? n : 1);
+}
+static inline void *kzalloc(size_t n, gfp_t f) { return calloc(1, n ? n : 1); }
+static inline void *kcalloc(size_t n, size_t s, gfp_t f) { return calloc(n ? n : 1, s); }
+static inline void *kmalloc_array(size_t n, size_t s, gfp_t f) { return kcalloc(n, s, f); }
+static inline void kfree(const void *p) { free((void *)p); }
+#define kvmalloc kmalloc
+#define kvzalloc kzalloc
+#define kvcalloc kcalloc
+#define kvmalloc_array kmalloc_array
+#define kvfree kfree
+
+struct kmem_cache
+{
+    size_t size;
+};
+static inline struct kmem_cache *kmem_cache_create(const char *name, unsigned int size,
+                                                   unsigned int align, unsigned long flags,
+                                                   void (*ctor)(void *))
+{
+    struct kmem_cache *c = malloc(sizeof(*c));
+
+    if (c)
+        c->size = size;
+    return c;
+}
+#define KMEM_CACHE(s, flags) kmem_cache_create(#s, sizeof(struct s), 0, flags, NULL)
+static inline void kmem_cache_destroy(struct kmem_cache *c) { free(c); }
+static inline void *kmem_cache_alloc(struct kmem_cache *c, gfp_t f) { return kmalloc(c->size, f); }
+static inline void kmem_cache_free(struct kmem_cache *c, void *p) { free(p); }
+
+/* refcount.h, atomic.h */
+typedef struct { int refs; } refcount_t;
+static inline void refcount_set(refcount_t *r, int n) { __atomic_store_n(&r->refs, n, __ATOMIC_RELAXED); }
+static inline void refcount_inc(refcount_t *r) { __atomic_fetch_add(&r->refs, 1, __ATOMIC_RELAXED); }
+static inline bool refcount_inc_not_zero(refcount_t *r)
+{
+    int old = __atomic_load_n(&r->refs, __ATOMIC_RELAXED);
+
+    do {
+        if (!old)
+            return false;
+    } while (!__atomic_compare_exchange_n(&r->refs, &old, old + 1, false,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return true;
+}
+static inline bool refcount_dec_and_test(refcount_t *r)
+{
+    return __atomic_sub_fetch(&r->refs, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+typedef struct { long long counter; } atomic64_t;
+#define atomic64_read(a) __atomic_load_n(&(a)->counter, __ATOMIC_RELAXED)
+#define atomic64_add(i, a) __atomic_add_fetch(&(a)->counter, (i), __ATOMIC_RELAXED)
+#define atomic64_inc(a) atomic64_add(1, a)
+
+/* uaccess.h: user pointers are plain pointers */
+static inline unsigned long copy_to_user(void *to, const void *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+static inline unsigned long copy_from_user(void *to, const void *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+#define u64_to_user_ptr(x) ((void *)(uintptr_t)(x))
+
+/* mutex.h */
+struct mutex
+{
+    pthread_mutex_t m;
+};
+static inline void mutex_init(struct mutex *l) { pthread_mutex_init(&l->m, NULL); }
+static inline void mutex_lock(struct mutex *l) { pthread_mutex_lock(&l->m); }
+static inline int mutex_lock_interruptible(struct mutex *l) { return pthread_mutex_lock(&l->m); }
+static inline int mutex_trylock(struct mutex *l) { return pthread_mutex_trylock(&l->m) == 0; }
+static inline void mutex_unlock(struct mutex *l) { pthread_mutex_unlock(&l->m); }
+
+/* rcupdate.h */
+extern pthread_rwlock_t aesd_shim_rcu_lock;
+struct rcu_head
+{
+    void (*func)(struct rcu_head *);
+    struct rcu_head *next;
+};
+static inline void rcu_read_lock(void) { pthread_rwlock_rdlock(&aesd_shim_rcu_lock); }
+static inline void rcu_read_unlock(void) { pthread_rwlock_unlock(&aesd_shim_rcu_lock); }
+static inline void synchronize_rcu(void)
+{
+    pthread_rwlock_wrlock(&aesd_shim_rcu_lock);
+    pthread_rwlock_unlock(&aesd_shim_rcu_lock);
+}
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *));
+void rcu_barrier(void);
+
+/* seqlock.h */
+typedef struct { unsigned int sequence; } seqcount_t;
+typedef struct { seqcount_t seqcount; } seqcount_mutex_t;
+#define seqcount_mutex_init(s, lock) ((s)->seqcount.sequence = 0)
+static inline unsigned int aesd_shim_read_seqcount_begin(seqcount_t *s)
+{
+    unsigned int v;
+
+    while ((v = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE)) & 1)
+        ;
+    return v;
+}
+static inline int aesd_shim_read_seqcount_retry(seqcount_t *s, unsigned int v)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&s->sequence, __ATOMIC_RELAXED) != v;
+}
+static inline void aesd_shim_write_seqcount_begin(seqcount_t *s)
+{
+    __atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+static inline void aesd_shim_write_seqcount_end(seqcount_t *s)
+{
+    __atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELEASE);
+}
+#define read_seqcount_begin(s) aesd_shim_read_seqcount_begin(&(s)->seqcount)
+#define read_seqcount_retry(s, v) aesd_shim_read_seqcount_retry(&(s)->seqcount, v)
+#define write_seqcount_begin(s) aesd_shim_write_seqcount_begin(&(s)->seqcount)
+#define write_seqcount_end(s) aesd_shim_write_seqcount_end(&(s)->seqcount)
+
+/* ktime.h */
+static inline u64 aesd_shim_clock_ns(clockid_t clock)
+{
+    struct timespec t;
+
+    clock_gettime(clock, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+#define ktime_get_ns() aesd_shim_clock_ns(CLOCK_MONOTONIC)
+#define ktime_get_real_ns() aesd_shim_clock_ns(CLOCK_REALTIME)
+
+/* mm.h, vmalloc.h: each page is a memfd, so it can be mapped more than once */
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define PAGE_ALIGN(x) (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+#define VM_MAP 0
+#define PAGE_KERNEL 0
+#define VM_WRITE 0x2
+#define VM_MAYWRITE 0x20
+
+struct page
+{
+    int fd;
+};
+struct page *alloc_page(gfp_t f);
+void __free_page(struct page *page);
+void *vmap(struct page **pages, unsigned int count, unsigned long flags, int prot);
+void vunmap(const void *addr);
+
+struct vm_area_struct
+{
+    unsigned long vm_flags;
+    /**
+     * Where vm_map_pages() mapped the pages
+     */
+    void *vm_start;
+};
+static inline void vm_flags_clear(struct vm_area_struct *vma, unsigned long flags)
+{
+    vma->vm_flags &= ~flags;
+}
+int vm_map_pages(struct vm_area_struct *vma, struct page **pages, unsigned long num);
+
+/* math64.h */
+static inline u64 div_u64_rem(u64 dividend, u32 divisor, u32 *remainder)
+{
+    *remainder = dividend % divisor;
+    return dividend / divisor;
+}
+
+/* crc32c.h: raw update without the standard inversions, as in the kernel */
+u32 crc32c(u32 crc, const void *data, unsigned int len);
+
+/* wait.h, poll.h: waiters sleep on a condition variable */
+typedef unsigned int __poll_t;
+#define EPOLLIN POLLIN
+#define EPOLLRDNORM POLLRDNORM
+#define EPOLLOUT POLLOUT
+#define EPOLLWRNORM POLLWRNORM
+
+typedef struct
+{
+    pthread_mutex_t m;
+    pthread_cond_t c;
+} wait_queue_head_t;
+static inline void init_waitqueue_head(wait_queue_head_t *q)
+{
+    pthread_mutex_init(&q->m, NULL);
+    pthread_cond_init(&q->c, NULL);
+}
+#define wake_up_interruptible_poll(q, mask) do {  \
+        pthread_mutex_lock(&(q)->m);              \
+        pthread_cond_broadcast(&(q)->c);          \
+        pthread_mutex_unlock(&(q)->m);            \
+    } while (0)
+#define wait_event_interruptible(q, cond) ({      \
+        pthread_mutex_lock(&(q).m);               \
+        while (!(cond))                           \
+            pthread_cond_wait(&(q).c, &(q).m);    \
+        pthread_mutex_unlock(&(q).m);             \
+        0;                                        \
+    })
+typedef struct poll_table_struct { int unused; } poll_table;
+#define poll_wait(filp, q, wait) ((void)0)
+
+/* fs.h, cdev.h */
+#define MINORBITS 20
+#define MKDEV(ma, mi) (((ma) << MINORBITS) | (mi))
+#define MAJOR(dev) ((unsigned int)((dev) >> MINORBITS))
+#define MINOR(dev) ((unsigned int)((dev) & ((1U << MINORBITS) - 1)))
+
+struct file_operations;
+struct cdev
+{
+    const struct file_operations *ops;
+    void *owner;
+    dev_t dev;
+};
+struct inode
+{
+    struct cdev *i_cdev;
+};
+struct file
+{
+    void *private_data;
+    loff_t f_pos;
+    unsigned int f_flags;
+};
+
+#define IOCB_NOWAIT 1
+struct kiocb
+{
+    struct file *ki_filp;
+    loff_t ki_pos;
+    int ki_flags;
+};
+struct iov_iter
+{
+    const struct iovec *iov;
+    unsigned long nr_segs;
+    size_t iov_offset;
+    size_t count;
+};
+static inline size_t iov_iter_count(const struct iov_iter *i) { return i->count; }
+size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i);
+size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *i);
+
+struct file_operations
+{
+    void *owner;
+    loff_t (*llseek)(struct file *, loff_t, int);
+    ssize_t (*read_iter)(struct kiocb *, struct iov_iter *);
+    ssize_t (*write_iter)(struct kiocb *, struct iov_iter *);
+    __poll_t (*poll)(struct file *, poll_table *);
+    long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+    int (*mmap)(struct file *, struct vm_area_struct *);
+    int (*open)(struct inode *, struct file *);
+    int (*release)(struct inode *, struct file *);
+};
+static inline void cdev_init(struct cdev *c, const struct file_operations *fops) { c->ops = fops; }
+static inline int cdev_add(struct cdev *c, dev_t dev, unsigned int count)
+{
+    c->dev = dev;
+    return 0;
+}
+static inline void cdev_del(struct cdev *c) {}
+static inline int alloc_chrdev_region(dev_t *dev, unsigned int first, unsigned int count,
+                                      const char *name)
+{
+    *dev = MKDEV(240, first);
+    return 0;
+}
+static inline void unregister_chrdev_region(dev_t dev, unsigned int count) {}
+
+/* device.h: class devices only keep what aesd_shim_sysfs() needs */
+#define AESD_SHIM_MAX_DEVICES 256
+
+struct attribute
+{
+    const char *name;
+    unsigned short mode;
+};
+struct attribute_group
+{
+    const char *name;
+    struct attribute **attrs;
+};
+struct device
+{
+    void *drvdata;
+};
+struct device_attribute
+{
+    struct attribute attr;
+    ssize_t (*show)(struct device *, struct device_attribute *, char *);
+    ssize_t (*store)(struct device *, struct device_attribute *, const char *, size_t);
+};
+struct class
+{
+    const struct attribute_group **dev_groups;
+    struct device *devices[AESD_SHIM_MAX_DEVICES];
+};
+#define DEVICE_ATTR_RO(_name) \
+    struct device_attribute dev_attr_##_name = { { #_name, 0444 }, _name##_show, NULL }
+#define DEVICE_ATTR_RW(_name) \
+    struct device_attribute dev_attr_##_name = { { #_name, 0644 }, _name##_show, _name##_store }
+// Not format checked: the driver prints u64 with %llu, as the kernel's u64 is unsigned long long
+static inline int sysfs_emit(char *buf, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, PAGE_SIZE, fmt, ap);
+    va_end(ap);
+    return n;
+}
+static inline void *dev_get_drvdata(const struct device *dev) { return dev->drvdata; }
+int kstrtoul(const char *s, unsigned int base, unsigned long *res);
+struct class *class_create(const char *name);
+void class_destroy(struct class *cls);
+struct device *device_create(struct class *cls, struct device *parent, dev_t devt,
+                             void *drvdata, const char *fmt, ...);
+void device_destroy(struct class *cls, dev_t devt);
+
+/* tracepoint.h: events compile to empty functions, arguments are still checked */
+#define TP_PROTO(args...) args
+#define TP_ARGS(args...) args
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+    static inline void trace_##name(proto) {}
+
+/*
+ * Helpers for programs driving the driver through aesd_fops
+ */
+int aesd_shim_module_init(void);
+void aesd_shim_module_exit(void);
+extern struct file_operations aesd_fops;
+
+/**
+ * Open minor @param minor of the loaded driver into @param filp, with
+ * @param flags as the file's f_flags.  @param inode must stay valid until
+ * aesd_shim_close().
+ * @return 0, or a negative errno from the driver's open
+ */
+int aesd_shim_open(struct inode *inode, struct file *filp, unsigned int minor,
+                   unsigned int flags);
+void aesd_shim_close(struct inode *inode, struct file *filp);
+
+/**
+ * read, pread, write and writev through the driver's read_iter and write_iter.
+ * read and write advance filp->f_pos, the p variants leave it alone.
+ */
+ssize_t aesd_shim_read(struct file *filp, void *buf, size_t count);
+ssize_t aesd_shim_pread(struct file *filp, void *buf, size_t count, loff_t pos);
+ssize_t aesd_shim_write(struct file *filp, const void *buf, size_t count);
+ssize_t aesd_shim_writev(struct file *filp, const struct iovec *iov, unsigned long nr);
+
+/**
+ * Read (@param in NULL, into @param out) or write (@param in) the sysfs
+ * attribute @param name of device @param minor
+ * @return the attribute's show or store result, or -ENOENT
+ */
+ssize_t aesd_shim_sysfs(unsigned int minor, const char *name, const char *in, char *out);
+
+#endif /* AESD_SHIM_H */
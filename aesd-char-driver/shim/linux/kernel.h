@@ -0,0 +1 @@
+#include "../aesd-shim.h"
@@ -0,0 +1 @@
+/* Tracepoints are empty functions in the shim, nothing to define */
@@ -0,0 +1,200 @@
+/**
+ * @file systemcalls-bench.c
+ * @brief Latency of do_exec() against fork() + execv() as the parent's RSS grows, and
+ * throughput of do_exec_batch() and do_exec_capture()
+ *
+ * fork() copies the parent's page tables, so its cost grows with the memory the
+ * parent has touched, while do_exec() spawns through posix_spawn(), which does not.
+ * For each RSS the parent first touches that much memory, then runs /bin/true
+ * repeatedly with both.
+ *
+ * Then a batch of short commands is run with do_exec() one after the other and
+ * with do_exec_batch() at several concurrency limits.
+ *
+ * Last, getting a command's output into memory is timed both ways: with
+ * do_exec_redirect() to a file which is then read back, and with do_exec_capture().
+ *
+ * Usage: systemcalls-bench [-m max_rss_mib] [-n runs] [-b batch_size]
+ */
+
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "../systemcalls.h"
+
+#define CAPTURE_RUNS 50
+
+/**
+ * @return the size of @param path, read back into memory as callers of
+ * do_exec_redirect() do, or -1
+ */
+static long read_back(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char *buf;
+    long size;
+
+    if (f == NULL)
+        return -1;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    buf = malloc(size + 1);
+    if (buf == NULL || fread(buf, 1, size, f) != (size_t)size)
+        size = -1;
+    free(buf);
+    fclose(f);
+    return size;
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/**
+ * do_exec() as it was implemented before posix_spawn(), with waitpid()
+ */
+static bool fork_exec(char *const command[])
+{
+    int status;
+    pid_t pid = fork();
+
+    if (pid < 0)
+        return false;
+    if (pid == 0) {
+        execv(command[0], command);
+        _exit(EXIT_FAILURE);
+    }
+    if (waitpid(pid, &status, 0) == -1)
+        return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static char *const command[] = { "/bin/true", NULL };
+    static const unsigned int limits[] = { 1, 4, 16, 64 };
+    unsigned long max_rss = 2048, rss, runs = 50, batch = 200, i;
+    struct exec_job *jobs;
+    double start;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:n:b:")) != -1) {
+        switch (opt) {
+        case 'm': max_rss = strtoul(optarg, NULL, 0); break;
+        case 'n': runs = strtoul(optarg, NULL, 0); break;
+        case 'b': batch = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "Usage: %s [-m max_rss_mib] [-n runs] [-b batch_size]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    printf("%10s %14s %14s\n", "RSS MiB", "fork us", "posix_spawn us");
+    for (rss = 0; rss <= max_rss; rss = rss ? rss * 2 : 64) {
+        size_t len = rss << 20;
+        char *mem = NULL;
+        double t_fork, t_spawn;
+
+        if (len) {
+            mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED) {
+                perror("mmap");
+                return 1;
+            }
+            // Touch every page, so the parent really has this RSS
+            memset(mem, 1, len);
+        }
+
+        start = now_us();
+        for (i = 0; i < runs; i++) {
+            if (!fork_exec(command)) {
+                fprintf(stderr, "fork/execv failed\n");
+                return 1;
+            }
+        }
+        t_fork = (now_us() - start) / runs;
+
+        start = now_us();
+        for (i = 0; i < runs; i++) {
+            if (!do_exec(1, command[0])) {
+                fprintf(stderr, "do_exec failed\n");
+                return 1;
+            }
+        }
+        t_spawn = (now_us() - start) / runs;
+
+        printf("%10lu %14.1f %14.1f\n", rss, t_fork, t_spawn);
+        if (mem)
+            munmap(mem, len);
+    }
+
+    jobs = calloc(batch, sizeof(*jobs));
+    if (jobs == NULL)
+        return 1;
+    for (i = 0; i < batch; i++)
+        jobs[i].argv = command;
+
+    printf("\n%lu x %s\n%10s %14s\n", batch, command[0], "parallel", "total ms");
+    start = now_us();
+    for (i = 0; i < batch; i++) {
+        if (!do_exec(1, command[0])) {
+            fprintf(stderr, "do_exec failed\n");
+            return 1;
+        }
+    }
+    printf("%10s %14.1f\n", "do_exec", (now_us() - start) / 1e3);
+    for (i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+        start = now_us();
+        if (!do_exec_batch(jobs, batch, limits[i])) {
+            fprintf(stderr, "do_exec_batch failed\n");
+            return 1;
+        }
+        printf("%10u %14.1f\n", limits[i], (now_us() - start) / 1e3);
+    }
+    free(jobs);
+
+    printf("\n%s of output into memory\n%14s %14s\n", "1 MiB", "redirect us", "capture us");
+    {
+        char path[] = "/tmp/systemcalls-bench-XXXXXX";
+        struct exec_output output;
+        double t_redirect, t_capture;
+        int fd = mkstemp(path);
+
+        if (fd < 0) {
+            perror("mkstemp");
+            return 1;
+        }
+        close(fd);
+
+        start = now_us();
+        for (i = 0; i < CAPTURE_RUNS; i++) {
+            if (!do_exec_redirect(path, 4, "/usr/bin/head", "-c", "1048576", "/dev/zero") ||
+                read_back(path) != 1048576) {
+                fprintf(stderr, "do_exec_redirect failed\n");
+                return 1;
+            }
+        }
+        t_redirect = (now_us() - start) / CAPTURE_RUNS;
+
+        start = now_us();
+        for (i = 0; i < CAPTURE_RUNS; i++) {
+            bool ok = do_exec_capture(&output, NULL, 4, "/usr/bin/head", "-c", "1048576", "/dev/zero");
+
+            if (!ok || output.out_len != 1048576) {
+                fprintf(stderr, "do_exec_capture failed\n");
+                return 1;
+            }
+            exec_output_free(&output);
+        }
+        t_capture = (now_us() - start) / CAPTURE_RUNS;
+
+        printf("%14.1f %14.1f\n", t_redirect, t_capture);
+        unlink(path);
+    }
+    return 0;
+}
@@ -0,0 +1,183 @@
+/**
+ * @file systemcalls-capture-test.c
+ * @brief Behaviour of do_exec_capture(): separate streams, truncation, timeouts and
+ * the output callback
+ *
+ * Each case runs a small shell or coreutils command and checks the returned
+ * struct exec_output.  The timeout cases also check that the call returned
+ * well before the command would have exited by itself, including for a command
+ * which closes its stdout and stderr before it stalls.
+ *
+ * Usage: systemcalls-capture-test
+ */
+
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "../systemcalls.h"
+
+static int failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("%s:%d: %s failed\n", __func__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void test_streams(void)
+{
+    struct exec_output output;
+
+    CHECK(do_exec_capture(&output, NULL, 3, "/bin/sh", "-c", "echo out; echo err >&2"));
+    CHECK(output.out != NULL && strcmp(output.out, "out\n") == 0 && output.out_len == 4);
+    CHECK(output.err != NULL && strcmp(output.err, "err\n") == 0 && output.err_len == 4);
+    CHECK(!output.truncated && !output.timed_out);
+    exec_output_free(&output);
+
+    CHECK(do_exec_capture(&output, NULL, 1, "/bin/true"));
+    CHECK(output.out == NULL && output.out_len == 0 && output.err == NULL);
+    exec_output_free(&output);
+
+    CHECK(!do_exec_capture(&output, NULL, 3, "/bin/sh", "-c", "echo failing; exit 3"));
+    CHECK(WIFEXITED(output.status) && WEXITSTATUS(output.status) == 3);
+    CHECK(output.out != NULL && strcmp(output.out, "failing\n") == 0);
+    exec_output_free(&output);
+}
+
+static void test_truncation(void)
+{
+    struct exec_capture_options options = { .max_bytes = 1000 };
+    struct exec_output output;
+
+    // Far more than a pipe holds, the rest must be drained for the command to exit
+    CHECK(do_exec_capture(&output, &options, 4, "/usr/bin/head", "-c", "1000000", "/dev/zero"));
+    CHECK(output.out_len == 1000 && output.truncated);
+    CHECK(WIFEXITED(output.status) && WEXITSTATUS(output.status) == 0);
+    exec_output_free(&output);
+
+    // Exactly the limit is not truncation
+    CHECK(do_exec_capture(&output, &options, 4, "/usr/bin/head", "-c", "1000", "/dev/zero"));
+    CHECK(output.out_len == 1000 && !output.truncated);
+    exec_output_free(&output);
+}
+
+static void test_timeout(void)
+{
+    struct exec_capture_options options = { .timeout_ms = 300 };
+    struct exec_output output;
+    double start;
+
+    start = now_s();
+    CHECK(!do_exec_capture(&output, &options, 3, "/bin/sh", "-c", "echo started; exec sleep 5"));
+    CHECK(now_s() - start < 2);
+    CHECK(output.timed_out && WIFSIGNALED(output.status) && WTERMSIG(output.status) == SIGKILL);
+    CHECK(output.out != NULL && strcmp(output.out, "started\n") == 0);
+    exec_output_free(&output);
+
+    // No more output to wait for, the timeout must still bound waiting for the exit
+    start = now_s();
+    CHECK(!do_exec_capture(&output, &options, 3, "/bin/sh", "-c", "exec >&- 2>&-; exec sleep 5"));
+    CHECK(now_s() - start < 2);
+    CHECK(output.timed_out && WIFSIGNALED(output.status));
+    exec_output_free(&output);
+
+    options.timeout_ms = 5000;
+    CHECK(do_exec_capture(&output, &options, 2, "/bin/echo", "quick"));
+    CHECK(!output.timed_out && output.out != NULL && strcmp(output.out, "quick\n") == 0);
+    exec_output_free(&output);
+}
+
+struct collected
+{
+    size_t out;
+    size_t err;
+    size_t calls;
+    bool zeros;
+};
+
+static void collect(void *ctx, int fd, const char *data, size_t len)
+{
+    struct collected *c = ctx;
+    size_t i;
+
+    c->calls++;
+    if (fd == STDOUT_FILENO)
+        c->out += len;
+    else
+        c->err += len;
+    for (i = 0; i < len; i++) {
+        if (data[i] != '\0')
+            c->zeros = false;
+    }
+}
+
+static void test_callback(void)
+{
+    struct collected c = { 0, 0, 0, true };
+    struct exec_capture_options options = { .callback = collect, .ctx = &c };
+    struct exec_output output;
+
+    CHECK(do_exec_capture(&output, &options, 3, "/bin/sh", "-c",
+                          "head -c 300000 /dev/zero; head -c 7 /dev/zero >&2"));
+    CHECK(c.out == 300000 && c.err == 7 && c.calls >= 2 && c.zeros);
+    CHECK(output.out == NULL && output.err == NULL);
+    CHECK(output.out_len == 300000 && output.err_len == 7);
+    exec_output_free(&output);
+
+    // The limit applies to what the callback receives too
+    memset(&c, 0, sizeof(c));
+    options.max_bytes = 4096;
+    CHECK(do_exec_capture(&output, &options, 4, "/usr/bin/head", "-c", "300000", "/dev/zero"));
+    CHECK(c.out == 4096 && output.truncated);
+    exec_output_free(&output);
+}
+
+/**
+ * With the address space capped, buffering 256 MiB fails part way.  The rest must
+ * be drained rather than the pipe closed, which would kill the command with SIGPIPE.
+ */
+static void test_out_of_memory(void)
+{
+    struct exec_output output;
+    struct rlimit limit;
+    pid_t pid;
+    int status;
+
+#ifdef __SANITIZE_ADDRESS__
+    // The sanitizer's shadow memory alone exceeds any useful address space limit
+    printf("%s: skipped under AddressSanitizer\n", __func__);
+    return;
+#endif
+    pid = fork();
+    if (pid == 0) {
+        limit.rlim_cur = limit.rlim_max = 64 * 1024 * 1024;
+        if (setrlimit(RLIMIT_AS, &limit) != 0)
+            _exit(2);
+        if (!do_exec_capture(&output, NULL, 4, "/usr/bin/head", "-c", "268435456", "/dev/zero"))
+            _exit(1);
+        _exit(output.truncated && output.out_len < 268435456 ? 0 : 1);
+    }
+    CHECK(pid > 0 && waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main(void)
+{
+    test_streams();
+    test_truncation();
+    test_timeout();
+    test_callback();
+    test_out_of_memory();
+
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
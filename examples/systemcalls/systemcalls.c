@@ -1,4 +1,12 @@
+#define _GNU_SOURCE // pipe2()
 #include "systemcalls.h"
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <time.h>
+#include <sys/syscall.h>
 
 /**
  * @param cmd the command to execute with system()
@@ -25,6 +33,92 @@ bool do_system(const char *cmd)
     return WIFEXITED(status) && WEXITSTATUS(status) == 0;
 }
 
+/**
+* Starts @param command, a NULL terminated argv whose first element is the full path of the
+* program, storing its pid in @param pid.  If @param outputfile is not NULL, the program's
+* stdout is redirected to it, truncating it first.  The file is opened here rather than in
+* the child, so a failure to open it is reported against the file, not the program.
+* If @param capture_fds is not NULL, the program's stdout and stderr are redirected to
+* capture_fds[0] and capture_fds[1].  Failures are reported on stderr.
+*
+* Uses posix_spawn() rather than fork(): glibc spawns with clone(CLONE_VM | CLONE_VFORK),
+* so the cost does not grow with the caller's page tables the way fork() does for a
+* process with a large RSS.  posix_spawn() also reports an exec or open failure in the
+* child directly, instead of through the child's exit status.
+* @return 0 if the program was started, or an errno value
+*/
+static int spawn_command(char *const command[], const char *outputfile,
+                         const int capture_fds[2], pid_t *pid)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_t *actionsp = NULL;
+    extern char **environ;
+    int out_fd = -1;
+    int err = 0;
+
+    if (outputfile != NULL) {
+        out_fd = open(outputfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out_fd == -1) {
+            err = errno;
+            fprintf(stderr, "open %s: %s\n", outputfile, strerror(err));
+            return err;
+        }
+    }
+
+    if (outputfile != NULL || capture_fds != NULL) {
+        err = posix_spawn_file_actions_init(&actions);
+        if (err != 0)
+            goto out;
+        if (outputfile != NULL)
+            err = posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+        if (err == 0 && capture_fds != NULL)
+            err = posix_spawn_file_actions_adddup2(&actions, capture_fds[0], STDOUT_FILENO);
+        if (err == 0 && capture_fds != NULL)
+            err = posix_spawn_file_actions_adddup2(&actions, capture_fds[1], STDERR_FILENO);
+        if (err != 0) {
+            posix_spawn_file_actions_destroy(&actions);
+            goto out;
+        }
+        actionsp = &actions;
+    }
+
+    err = posix_spawn(pid, command[0], actionsp, NULL, command, environ);
+    if (actionsp != NULL)
+        posix_spawn_file_actions_destroy(actionsp);
+
+out:
+    if (err != 0)
+        fprintf(stderr, "posix_spawn %s: %s\n", command[0], strerror(err));
+    if (out_fd != -1)
+        close(out_fd);
+    return err;
+}
+
+/**
+* Runs @param command, redirecting its stdout to @param outputfile if not NULL, see
+* spawn_command(), and waits for it to exit.
+* @return true if the program ran and exited with status 0
+*/
+static bool spawn_and_wait(char *const command[], const char *outputfile)
+{
+    pid_t pid;
+    int status;
+    int err;
+
+    err = spawn_command(command, outputfile, NULL, &pid);
+    if (err != 0)
+        return false;
+
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            perror("waitpid");
+            return false;
+        }
+    }
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
 /**
 * @param count -The numbers of variables passed to the function. The variables are command to execute.
 *   followed by arguments to pass to the command
@@ -51,52 +145,315 @@ bool do_exec(int count, ...)
     }
     command[count] = NULL;
     va_end(args);
-/*
- * TODO:
- *   Execute a system command by calling fork, execv(),
- *   and wait instead of system (see LSP page 161).
- *   Use the command[0] as the full path to the command to execute
- *   (first argument to execv), and use the remaining arguments
- *   as second argument to the execv() command.
- *
+
+    return spawn_and_wait(command, NULL);
+}
+
+/**
+* @param outputfile - The full path to the file to write with command output.
+*   This file will be closed at completion of the function call.
+* All other parameters, see do_exec above
 */
-    pid_t pid = fork();
+bool do_exec_redirect(const char *outputfile, int count, ...)
+{
+    va_list args;
+    va_start(args, count);
+    char * command[count+1];
+    int i;
+    for(i=0; i<count; i++)
+    {
+        command[i] = va_arg(args, char *);
+    }
+    command[count] = NULL;
+    va_end(args);
+
+    return spawn_and_wait(command, outputfile);
+}
+
+/**
+* A command started by do_exec_batch() and not reaped yet
+*/
+struct running_job
+{
+    struct exec_job *job;
+    pid_t pid;
+    /**
+    * pidfd of the command, readable once it exits, or -1 where pidfds are not supported
+    */
+    int pidfd;
+};
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    return -1;
+#endif
+}
+
+/**
+* Waits until at least one of the @param nr_running commands in @param running may have
+* exited: poll() on their pidfds, or a short sleep if any of them has none
+*/
+static void wait_for_exit(struct running_job *running, struct pollfd *pfds, unsigned int nr_running)
+{
+    unsigned int nfds = 0;
+    unsigned int i;
+
+    for (i = 0; i < nr_running; i++) {
+        if (running[i].pidfd < 0)
+            continue;
+        pfds[nfds].fd = running[i].pidfd;
+        pfds[nfds].events = POLLIN;
+        nfds++;
+    }
+    // Without a pidfd for every command, poll() only bounds the wait
+    if (poll(pfds, nfds, nfds == nr_running ? -1 : 1) == -1 && errno != EINTR)
+        perror("poll");
+}
+
+/**
+* Runs the @param count commands described by @param jobs, at most @param max_parallel
+* of them at a time (0 for one per online CPU), in order of their position in @param jobs.
+* Each command is waited for by its own pid, so children the caller started otherwise are
+* left alone.  Exits are noticed through pidfds where the kernel provides them.
+* The status, error and timing fields of every job are set on return.
+* @return true if every command ran and exited with status 0
+*/
+bool do_exec_batch(struct exec_job *jobs, size_t count, unsigned int max_parallel)
+{
+    struct running_job *running;
+    struct pollfd *pfds;
+    unsigned int nr_running = 0;
+    bool ok = true;
+    size_t next = 0;
+    unsigned int i;
+
+    if (max_parallel == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        max_parallel = cpus > 0 ? cpus : 1;
+    }
+    if (max_parallel > count)
+        max_parallel = count ? count : 1;
 
-    if (pid < 0) {
-        perror("fork");
+    running = calloc(max_parallel, sizeof(*running));
+    pfds = calloc(max_parallel, sizeof(*pfds));
+    if (running == NULL || pfds == NULL) {
+        free(running);
+        free(pfds);
+        for (next = 0; next < count; next++)
+            jobs[next].error = ENOMEM;
         return false;
     }
-    else if (pid == 0) {
-        execv(command[0], command);
-        perror("execv");
-        exit(EXIT_FAILURE);
+
+    while (next < count || nr_running > 0) {
+        while (next < count && nr_running < max_parallel) {
+            struct exec_job *job = &jobs[next++];
+            struct running_job *r = &running[nr_running];
+
+            job->status = 0;
+            job->start_ns = monotonic_ns();
+            job->error = spawn_command(job->argv, job->outputfile, NULL, &r->pid);
+            if (job->error != 0) {
+                job->end_ns = job->start_ns;
+                ok = false;
+                continue;
+            }
+            r->job = job;
+            r->pidfd = open_pidfd(r->pid);
+            nr_running++;
+        }
+        if (nr_running == 0)
+            break;
+
+        wait_for_exit(running, pfds, nr_running);
+
+        for (i = 0; i < nr_running; ) {
+            struct running_job *r = &running[i];
+            pid_t pid = waitpid(r->pid, &r->job->status, WNOHANG);
+
+            if (pid == 0 || (pid == -1 && errno == EINTR)) {
+                i++;
+                continue;
+            }
+            r->job->end_ns = monotonic_ns();
+            if (pid == -1) {
+                r->job->error = errno;
+                perror("waitpid");
+            }
+            if (!exec_job_succeeded(r->job))
+                ok = false;
+            if (r->pidfd >= 0)
+                close(r->pidfd);
+            *r = running[--nr_running];
+        }
     }
-    else {
-        int status;
-        if (wait(&status) == -1) {
-            perror("wait");
-            return false;
+
+    free(running);
+    free(pfds);
+    return ok;
+}
+
+/**
+* A stream of the command run by do_exec_capture(), read through a pipe
+*/
+struct capture_stream
+{
+    int fd;
+    /**
+    * STDOUT_FILENO or STDERR_FILENO
+    */
+    int target;
+    char **buf;
+    size_t *len;
+    size_t cap;
+    /**
+    * The buffer could not grow, the rest of the stream is drained and discarded
+    */
+    bool discard;
+};
+
+#define CAPTURE_READ_SIZE 65536
+
+/**
+* Reads what is available from @param stream, appending it to the stream's buffer, or
+* passing it to the options' callback.  Output beyond options->max_bytes, or past a
+* failure to grow the buffer, is read and discarded so the command never sees a closed
+* pipe.
+* @return the result of read(): 0 at end of file, negative on error
+*/
+static ssize_t capture_read(struct capture_stream *stream, const struct exec_capture_options *options,
+                            struct exec_output *output)
+{
+    size_t limit = options->max_bytes ? options->max_bytes : SIZE_MAX;
+    bool keep = !stream->discard && *stream->len < limit;
+    char scratch[CAPTURE_READ_SIZE];
+    size_t want = CAPTURE_READ_SIZE;
+    char *dst = scratch;
+    ssize_t n;
+
+    if (keep) {
+        if (want > limit - *stream->len)
+            want = limit - *stream->len;
+        // Read straight into the buffer's spare capacity, growing it first if needed
+        if (options->callback == NULL) {
+            size_t needed = *stream->len + want + 1;
+
+            if (stream->cap < needed) {
+                size_t cap = stream->cap * 2 > needed ? stream->cap * 2 : needed;
+                char *buf = realloc(*stream->buf, cap);
+
+                if (buf == NULL) {
+                    perror("realloc");
+                    stream->discard = true;
+                    keep = false;
+                    want = CAPTURE_READ_SIZE;
+                } else {
+                    *stream->buf = buf;
+                    stream->cap = cap;
+                }
+            }
+            if (keep)
+                dst = *stream->buf + *stream->len;
         }
+    }
 
-        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-            return true;
-        } else {
-            return false;
+    n = read(stream->fd, dst, want);
+    if (n <= 0)
+        return n;
+
+    if (!keep) {
+        output->truncated = true;
+    } else if (options->callback != NULL) {
+        options->callback(options->ctx, stream->target, dst, n);
+        *stream->len += n;
+    } else {
+        *stream->len += n;
+        (*stream->buf)[*stream->len] = '\0';
+    }
+    return n;
+}
+
+/**
+* Waits for @param pid to exit, without reaping it, until @param deadline, a
+* monotonic_ns() time, and kills it with SIGKILL if it is still running then.
+* @return true if it had to be killed
+*/
+static bool wait_until(pid_t pid, uint64_t deadline)
+{
+    int pidfd = open_pidfd(pid);
+    bool killed = false;
+
+    for (;;) {
+        struct pollfd pfd = { pidfd, POLLIN, 0 };
+        uint64_t now = monotonic_ns();
+        siginfo_t info;
+        int timeout;
+
+        info.si_pid = 0;
+        if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (info.si_pid == pid)
+            break;
+        if (now >= deadline) {
+            kill(pid, SIGKILL);
+            killed = true;
+            break;
         }
+
+        timeout = (deadline - now + 999999) / 1000000;
+        // Without a pidfd, poll() only bounds the wait
+        if (pidfd < 0 && timeout > 1)
+            timeout = 1;
+        poll(&pfd, pidfd >= 0, timeout);
     }
+
+    if (pidfd >= 0)
+        close(pidfd);
+    return killed;
 }
 
 /**
-* @param outputfile - The full path to the file to write with command output.
-*   This file will be closed at completion of the function call.
-* All other parameters, see do_exec above
+* Runs a command like do_exec(), capturing its stdout and stderr through pipes into
+* @param output instead of letting them go to the caller's.  Output is polled from both
+* pipes as it arrives, so neither can fill up and block the command, and read straight
+* into buffers which grow as needed, or handed to @param options' callback.
+* @param options limits and callback, or NULL for unlimited buffered capture.
+* Reading stops when the command and everything it started have closed both pipes, or
+* the timeout expires.  The timeout also bounds waiting for the command to exit after
+* it closed the pipes.  @param output must be released with exec_output_free().
+* @return true if the command ran, exited with status 0 and did not time out
 */
-bool do_exec_redirect(const char *outputfile, int count, ...)
+bool do_exec_capture(struct exec_output *output, const struct exec_capture_options *options,
+                     int count, ...)
 {
+    static const struct exec_capture_options defaults;
+    struct capture_stream streams[2];
+    struct pollfd pfds[2];
+    int out_pipe[2], err_pipe[2];
+    int child_fds[2];
+    uint64_t deadline = 0;
     va_list args;
+    pid_t pid;
+    int status;
+    int err;
+    int i;
+
     va_start(args, count);
     char * command[count+1];
-    int i;
     for(i=0; i<count; i++)
     {
         command[i] = va_arg(args, char *);
@@ -104,36 +461,114 @@ bool do_exec_redirect(const char *outputfile, int count, ...)
     command[count] = NULL;
     va_end(args);
 
-    pid_t pid = fork();
+    memset(output, 0, sizeof(*output));
+    if (options == NULL)
+        options = &defaults;
 
-    if (pid < 0) {
-        perror("fork");
+    if (pipe2(out_pipe, O_CLOEXEC) == -1) {
+        perror("pipe2");
         return false;
-    } else if (pid == 0) {
-        int fd = open(outputfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        if (fd < 0) {
-            perror("open");
-            exit(EXIT_FAILURE);
+    }
+    if (pipe2(err_pipe, O_CLOEXEC) == -1) {
+        perror("pipe2");
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        return false;
+    }
+
+    child_fds[0] = out_pipe[1];
+    child_fds[1] = err_pipe[1];
+    err = spawn_command(command, NULL, child_fds, &pid);
+    close(out_pipe[1]);
+    close(err_pipe[1]);
+    if (err != 0) {
+        close(out_pipe[0]);
+        close(err_pipe[0]);
+        return false;
+    }
+
+    streams[0] = (struct capture_stream){ out_pipe[0], STDOUT_FILENO, &output->out, &output->out_len, 0, false };
+    streams[1] = (struct capture_stream){ err_pipe[0], STDERR_FILENO, &output->err, &output->err_len, 0, false };
+    if (options->timeout_ms)
+        deadline = monotonic_ns() + (uint64_t)options->timeout_ms * 1000000u;
+
+    while (streams[0].fd >= 0 || streams[1].fd >= 0) {
+        int timeout = -1;
+        int ready;
+
+        if (deadline) {
+            uint64_t now = monotonic_ns();
+
+            if (now >= deadline) {
+                kill(pid, SIGKILL);
+                output->timed_out = true;
+                break;
+            }
+            // Round up, so the loop does not spin on a sub-millisecond remainder
+            timeout = (deadline - now + 999999) / 1000000;
         }
 
-        if (dup2(fd, STDOUT_FILENO) < 0) {
-            perror("dup2");
-            close(fd);
-            exit(EXIT_FAILURE);
+        for (i = 0; i < 2; i++) {
+            pfds[i].fd = streams[i].fd;
+            pfds[i].events = POLLIN;
+        }
+        ready = poll(pfds, 2, timeout);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            kill(pid, SIGKILL);
+            break;
         }
 
-        close(fd);
+        for (i = 0; i < 2; i++) {
+            ssize_t n;
 
-        execv(command[0], command);
-        perror("execv");
-        exit(EXIT_FAILURE);
-    } else {
-        int status;
-        if (wait(&status) == -1) {
-            perror("wait");
-            return false;
+            if (streams[i].fd < 0 || pfds[i].revents == 0)
+                continue;
+            n = capture_read(&streams[i], options, output);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                if (n < 0)
+                    perror("read");
+                close(streams[i].fd);
+                streams[i].fd = -1;
+            }
         }
+    }
 
-        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    for (i = 0; i < 2; i++) {
+        if (streams[i].fd >= 0)
+            close(streams[i].fd);
+        // Buffers are grown before each read, drop those no output went into
+        if (*streams[i].len == 0) {
+            free(*streams[i].buf);
+            *streams[i].buf = NULL;
+        }
     }
+
+    if (deadline && !output->timed_out && wait_until(pid, deadline))
+        output->timed_out = true;
+
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            perror("waitpid");
+            return false;
+        }
+    }
+    output->status = status;
+
+    return !output->timed_out && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+* Releases the buffers of @param output, filled by do_exec_capture()
+*/
+void exec_output_free(struct exec_output *output)
+{
+    free(output->out);
+    free(output->err);
+    output->out = NULL;
+    output->err = NULL;
 }
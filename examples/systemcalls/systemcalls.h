@@ -5,9 +5,108 @@
 #include <stdarg.h>
 #include <stdbool.h>
 #include <fcntl.h>
+#include <stdint.h>
 
 bool do_system(const char *command);
 
 bool do_exec(int count, ...);
 
 bool do_exec_redirect(const char *outputfile, int count, ...);
+
+/**
+ * A command run by do_exec_batch()
+ */
+struct exec_job
+{
+    /**
+     * NULL terminated argument list, argv[0] is the full path of the program
+     */
+    char *const *argv;
+    /**
+     * File to redirect the command's stdout to, as do_exec_redirect() does, or NULL
+     */
+    const char *outputfile;
+    /**
+     * Set by do_exec_batch(): the wait status of the command, as returned by waitpid()
+     */
+    int status;
+    /**
+     * Set by do_exec_batch(): 0, or the errno value which kept the command from
+     * starting or being waited for
+     */
+    int error;
+    /**
+     * Set by do_exec_batch(): CLOCK_MONOTONIC times at which the command was started
+     * and found to have exited, in nanoseconds
+     */
+    uint64_t start_ns;
+    uint64_t end_ns;
+};
+
+/**
+ * @return true if @param job ran and exited with status 0
+ */
+static inline bool exec_job_succeeded(const struct exec_job *job)
+{
+    return job->error == 0 && WIFEXITED(job->status) && WEXITSTATUS(job->status) == 0;
+}
+
+bool do_exec_batch(struct exec_job *jobs, size_t count, unsigned int max_parallel);
+
+/**
+ * Output captured by do_exec_capture()
+ */
+struct exec_output
+{
+    /**
+     * stdout and stderr of the command, NUL terminated, or NULL if the command wrote
+     * nothing or a callback received the output.  Released by exec_output_free().
+     * The lengths count the bytes kept, including those passed to a callback.
+     */
+    char *out;
+    size_t out_len;
+    char *err;
+    size_t err_len;
+    /**
+     * Wait status of the command, as returned by waitpid()
+     */
+    int status;
+    /**
+     * Output beyond the max_bytes limit, or which a buffer could not grow to hold,
+     * was read and discarded
+     */
+    bool truncated;
+    /**
+     * The command was killed with SIGKILL once its timeout expired
+     */
+    bool timed_out;
+};
+
+/**
+ * Receives captured output as it arrives, instead of it being buffered
+ * @param fd STDOUT_FILENO or STDERR_FILENO, the stream @param data was written to
+ */
+typedef void (*exec_output_cb)(void *ctx, int fd, const char *data, size_t len);
+
+struct exec_capture_options
+{
+    /**
+     * Bytes kept per stream, 0 for no limit.  Later output is drained and discarded,
+     * so the command never blocks on a full pipe.
+     */
+    size_t max_bytes;
+    /**
+     * Milliseconds after which the command is killed, 0 for no timeout
+     */
+    unsigned int timeout_ms;
+    /**
+     * If not NULL, output is passed to callback, with ctx, instead of being buffered
+     */
+    exec_output_cb callback;
+    void *ctx;
+};
+
+bool do_exec_capture(struct exec_output *output, const struct exec_capture_options *options,
+                     int count, ...);
+
+void exec_output_free(struct exec_output *output);
@@ -0,0 +1,221 @@
+/**
+ * @file aesd-crc32c.c
+ * @brief CRC32C with runtime selection of a hardware implementation
+ *
+ * See aesd-crc32c.h for details.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "aesd-crc32c.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define HAVE_CRC32C_SSE42 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define HAVE_CRC32C_ARMV8 1
+#endif
+
+#define CRC32C_POLY 0x82f63b78u
+
+/*
+ * Long buffers are split into three lanes of CRC_LANE bytes which are
+ * checksummed in parallel, hiding the latency of the crc32 instruction.
+ * crc_shift_table advances a raw CRC register over CRC_LANE zero bytes so
+ * the lane results can be combined.
+ */
+#define CRC_LANE 2048
+
+static uint32_t crc_table[8][256];
+static uint32_t crc_shift_table[4][256];
+static uint32_t (*crc_impl)(uint32_t, const void *, size_t);
+static const char *crc_impl_name;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static uint32_t crc32c_table(uint32_t crc, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    crc = ~crc;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len && ((uintptr_t)p & 7)) {
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t w;
+
+        memcpy(&w, p, sizeof(w));
+        w ^= crc;
+        crc = crc_table[7][w & 0xff] ^
+              crc_table[6][(w >> 8) & 0xff] ^
+              crc_table[5][(w >> 16) & 0xff] ^
+              crc_table[4][(w >> 24) & 0xff] ^
+              crc_table[3][(w >> 32) & 0xff] ^
+              crc_table[2][(w >> 40) & 0xff] ^
+              crc_table[1][(w >> 48) & 0xff] ^
+              crc_table[0][w >> 56];
+        p += 8;
+        len -= 8;
+    }
+#endif
+    while (len--)
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static inline uint32_t crc_shift(uint32_t c)
+{
+    return crc_shift_table[0][c & 0xff] ^ crc_shift_table[1][(c >> 8) & 0xff] ^
+           crc_shift_table[2][(c >> 16) & 0xff] ^ crc_shift_table[3][c >> 24];
+}
+
+#if HAVE_CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    uint32_t c = ~crc;
+
+    while (len && ((uintptr_t)p & 7)) {
+        c = _mm_crc32_u8(c, *p++);
+        len--;
+    }
+#ifdef __x86_64__
+    while (len >= 3 * CRC_LANE) {
+        uint64_t a = c, b = 0, d = 0;
+        size_t i;
+
+        for (i = 0; i < CRC_LANE; i += 8) {
+            uint64_t wa, wb, wd;
+
+            memcpy(&wa, p + i, sizeof(wa));
+            memcpy(&wb, p + CRC_LANE + i, sizeof(wb));
+            memcpy(&wd, p + 2 * CRC_LANE + i, sizeof(wd));
+            a = _mm_crc32_u64(a, wa);
+            b = _mm_crc32_u64(b, wb);
+            d = _mm_crc32_u64(d, wd);
+        }
+        c = crc_shift(crc_shift((uint32_t)a) ^ (uint32_t)b) ^ (uint32_t)d;
+        p += 3 * CRC_LANE;
+        len -= 3 * CRC_LANE;
+    }
+    {
+        uint64_t c64 = c;
+
+        while (len >= 8) {
+            uint64_t w;
+
+            memcpy(&w, p, sizeof(w));
+            c64 = _mm_crc32_u64(c64, w);
+            p += 8;
+            len -= 8;
+        }
+        c = (uint32_t)c64;
+    }
+#endif
+    while (len >= 4) {
+        uint32_t w;
+
+        memcpy(&w, p, sizeof(w));
+        c = _mm_crc32_u32(c, w);
+        p += 4;
+        len -= 4;
+    }
+    while (len--)
+        c = _mm_crc32_u8(c, *p++);
+    return ~c;
+}
+#endif
+
+#if HAVE_CRC32C_ARMV8
+static uint32_t crc32c_armv8(uint32_t crc, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    uint32_t c = ~crc;
+
+    while (len >= 8) {
+        uint64_t w;
+
+        memcpy(&w, p, sizeof(w));
+        c = __crc32cd(c, w);
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+        c = __crc32cb(c, *p++);
+    return ~c;
+}
+#endif
+
+static void crc32c_init(void)
+{
+    uint32_t basis[32];
+    uint32_t n, k, c;
+
+    for (n = 0; n < 256; n++) {
+        c = n;
+        for (k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc_table[0][n] = c;
+    }
+    for (n = 0; n < 256; n++) {
+        c = crc_table[0][n];
+        for (k = 1; k < 8; k++) {
+            c = crc_table[0][c & 0xff] ^ (c >> 8);
+            crc_table[k][n] = c;
+        }
+    }
+
+    // The zero byte shift is linear, build it from the image of each bit
+    for (k = 0; k < 32; k++) {
+        c = 1u << k;
+        for (n = 0; n < CRC_LANE; n++)
+            c = crc_table[0][c & 0xff] ^ (c >> 8);
+        basis[k] = c;
+    }
+    for (k = 0; k < 4; k++) {
+        for (n = 0; n < 256; n++) {
+            uint32_t bit;
+
+            c = 0;
+            for (bit = 0; bit < 8; bit++) {
+                if (n & (1u << bit))
+                    c ^= basis[8 * k + bit];
+            }
+            crc_shift_table[k][n] = c;
+        }
+    }
+
+    crc_impl = crc32c_table;
+    crc_impl_name = "table";
+#if HAVE_CRC32C_SSE42
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc_impl = crc32c_sse42;
+        crc_impl_name = "sse4.2";
+    }
+#elif HAVE_CRC32C_ARMV8
+    crc_impl = crc32c_armv8;
+    crc_impl_name = "armv8";
+#endif
+}
+
+uint32_t aesd_crc32c(uint32_t crc, const void *data, size_t len)
+{
+    pthread_once(&crc_once, crc32c_init);
+    return crc_impl(crc, data, len);
+}
+
+uint32_t aesd_crc32c_sw(uint32_t crc, const void *data, size_t len)
+{
+    pthread_once(&crc_once, crc32c_init);
+    return crc32c_table(crc, data, len);
+}
+
+const char *aesd_crc32c_impl(void)
+{
+    pthread_once(&crc_once, crc32c_init);
+    return crc_impl_name;
+}
@@ -0,0 +1,36 @@
+/*
+ * aesd-crc32c.h
+ *
+ *  @brief CRC32C (Castagnoli) checksums used to protect stored aesdsocket records
+ *
+ *  Uses the SSE4.2 crc32 instruction on x86 when the running CPU supports it,
+ *  the ARMv8 CRC extension when the compiler targets it, and a slicing-by-8
+ *  table otherwise.  All implementations produce the standard CRC32C value
+ *  (initial value and final xor of 0xffffffff).
+ */
+
+#ifndef AESD_CRC32C_H
+#define AESD_CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Extend @param crc, the CRC32C of previous data (0 to start), with @param len
+ * bytes at @param data.
+ * @return the CRC32C of the previous data followed by @param data
+ */
+uint32_t aesd_crc32c(uint32_t crc, const void *data, size_t len);
+
+/**
+ * Table driven implementation, exposed so it can be compared with the
+ * accelerated one.
+ */
+uint32_t aesd_crc32c_sw(uint32_t crc, const void *data, size_t len);
+
+/**
+ * @return a short name of the implementation selected by aesd_crc32c()
+ */
+const char *aesd_crc32c_impl(void);
+
+#endif /* AESD_CRC32C_H */
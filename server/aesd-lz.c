@@ -0,0 +1,192 @@
+/**
+ * @file aesd-lz.c
+ * @brief Greedy single pass LZ77 compressor and bounds checked decompressor
+ *
+ * See aesd-lz.h for a description of the block format.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "aesd-lz.h"
+
+#define MIN_MATCH 4
+#define HASH_LOG 12
+#define RUN_MASK 15
+
+static inline uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline unsigned int hash4(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - HASH_LOG);
+}
+
+/**
+ * Write the extension bytes for a length field which overflowed its nibble
+ */
+static unsigned char *put_length(unsigned char *op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+/**
+ * Emit one sequence of @param lit_len literals followed by a match of
+ * @param match_len bytes at @param offset.  A @param match_len of 0 emits the
+ * literal only sequence which terminates a block.
+ * @return the new output position, or NULL if the sequence does not fit
+ */
+static unsigned char *put_sequence(unsigned char *op, unsigned char *oend,
+                                   const unsigned char *lit, size_t lit_len,
+                                   size_t offset, size_t match_len)
+{
+    unsigned char *token = op;
+    size_t need = 1 + lit_len + lit_len / 255 + 1;
+
+    if (match_len)
+        need += 2 + (match_len - MIN_MATCH) / 255 + 1;
+    if (need > (size_t)(oend - op))
+        return NULL;
+
+    op++;
+    if (lit_len >= RUN_MASK) {
+        *token = RUN_MASK << 4;
+        op = put_length(op, lit_len - RUN_MASK);
+    } else {
+        *token = (unsigned char)(lit_len << 4);
+    }
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (match_len) {
+        size_t ml = match_len - MIN_MATCH;
+
+        *op++ = (unsigned char)(offset & 0xff);
+        *op++ = (unsigned char)(offset >> 8);
+        if (ml >= RUN_MASK) {
+            *token |= RUN_MASK;
+            op = put_length(op, ml - RUN_MASK);
+        } else {
+            *token |= (unsigned char)ml;
+        }
+    }
+    return op;
+}
+
+size_t aesd_lz_compress(const unsigned char *src, size_t src_len,
+                        unsigned char *dst, size_t dst_cap)
+{
+    uint32_t table[1 << HASH_LOG];
+    const unsigned char *ip = src;
+    const unsigned char *anchor = src;
+    const unsigned char *iend = src + src_len;
+    unsigned char *op = dst;
+    unsigned char *oend = dst + dst_cap;
+
+    memset(table, 0, sizeof(table));
+
+    while (iend - ip >= MIN_MATCH) {
+        uint32_t seq = read32(ip);
+        unsigned int h = hash4(seq);
+        const unsigned char *ref = src + table[h];
+
+        table[h] = (uint32_t)(ip - src);
+        if (ref < ip && ip - ref <= AESD_LZ_MAX_OFFSET && read32(ref) == seq) {
+            const unsigned char *mp = ip + MIN_MATCH;
+            const unsigned char *rp = ref + MIN_MATCH;
+
+            while (mp < iend && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+            op = put_sequence(op, oend, anchor, ip - anchor, ip - ref, mp - ip);
+            if (!op)
+                return 0;
+            ip = mp;
+            anchor = ip;
+        } else {
+            ip++;
+        }
+    }
+
+    op = put_sequence(op, oend, anchor, iend - anchor, 0, 0);
+    if (!op)
+        return 0;
+    return op - dst;
+}
+
+/**
+ * Read a length field extension, adding it to @param len.
+ * @return false if the input ended before the length was complete
+ */
+static int get_length(const unsigned char **ipp, const unsigned char *iend, size_t *len)
+{
+    const unsigned char *ip = *ipp;
+    unsigned char b;
+
+    do {
+        if (ip >= iend)
+            return 0;
+        b = *ip++;
+        *len += b;
+    } while (b == 255);
+    *ipp = ip;
+    return 1;
+}
+
+ssize_t aesd_lz_decompress(const unsigned char *src, size_t src_len,
+                           unsigned char *dst, size_t dst_cap)
+{
+    const unsigned char *ip = src;
+    const unsigned char *iend = src + src_len;
+    unsigned char *op = dst;
+    unsigned char *oend = dst + dst_cap;
+
+    while (ip < iend) {
+        unsigned char token = *ip++;
+        size_t lit_len = token >> 4;
+        size_t match_len = token & RUN_MASK;
+        size_t offset;
+
+        if (lit_len == RUN_MASK && !get_length(&ip, iend, &lit_len))
+            return -1;
+        if (lit_len > (size_t)(iend - ip) || lit_len > (size_t)(oend - op))
+            return -1;
+        memcpy(op, ip, lit_len);
+        op += lit_len;
+        ip += lit_len;
+
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst))
+            return -1;
+
+        if (match_len == RUN_MASK && !get_length(&ip, iend, &match_len))
+            return -1;
+        match_len += MIN_MATCH;
+        if (match_len > (size_t)(oend - op))
+            return -1;
+
+        // Matches may overlap their own output, so copy forward byte by byte
+        {
+            const unsigned char *mp = op - offset;
+            while (match_len--)
+                *op++ = *mp++;
+        }
+    }
+    return op - dst;
+}
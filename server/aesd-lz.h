@@ -0,0 +1,44 @@
+/*
+ * aesd-lz.h
+ *
+ *  @brief Small self-contained LZ77 block codec used for compressed aesdsocket replies
+ *
+ *  The block format follows the LZ4 block layout: a sequence is a token byte
+ *  (high nibble literal length, low nibble match length - 4), optional length
+ *  extension bytes (runs of 255), the literals, a 2 byte little endian match
+ *  offset and optional match length extension bytes.  The last sequence of a
+ *  block carries literals only.
+ */
+
+#ifndef AESD_LZ_H
+#define AESD_LZ_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Largest distance a match may reference, limited by the 2 byte offset field
+ */
+#define AESD_LZ_MAX_OFFSET 65535
+
+/**
+ * @return worst case compressed size of @param len input bytes
+ */
+#define AESD_LZ_BOUND(len) ((len) + (len) / 255 + 16)
+
+/**
+ * Compress @param src_len bytes at @param src into @param dst.
+ * @return the compressed size, or 0 if the result did not fit in @param dst_cap bytes
+ */
+size_t aesd_lz_compress(const unsigned char *src, size_t src_len,
+                        unsigned char *dst, size_t dst_cap);
+
+/**
+ * Decompress a block produced by aesd_lz_compress().
+ * @return the decompressed size, or -1 if the block is malformed or does not
+ *      fit in @param dst_cap bytes
+ */
+ssize_t aesd_lz_decompress(const unsigned char *src, size_t src_len,
+                           unsigned char *dst, size_t dst_cap);
+
+#endif /* AESD_LZ_H */
@@ -0,0 +1,68 @@
+/*
+ * aesd-mmap.h
+ *
+ *  @brief Read aesdchar records in place through a read-only mapping of the device
+ *
+ *  The driver describes the records it keeps for mmap in a header page, see
+ *  struct aesd_mmap_header in aesd_ioctl.h.  aesd_mmap_records() takes a
+ *  consistent copy of those descriptions, the bytes of each record can then be
+ *  read directly from aesd_mmap_record_data().  The driver may overwrite them
+ *  at any time, aesd_mmap_record_intact() tells whether it did so before the
+ *  caller finished reading.
+ */
+
+#ifndef AESD_MMAP_H
+#define AESD_MMAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "aesd_ioctl.h"
+
+struct aesd_mmap
+{
+    int fd;
+    void *map;
+    size_t map_len;
+    const struct aesd_mmap_header *hdr;
+    /**
+     * The data area, mapped twice in a row so records never wrap
+     */
+    const char *data;
+    uint64_t data_size;
+};
+
+/**
+ * Open and map the aesdchar device at @param path
+ * @return 0, or -1 with errno set
+ */
+int aesd_mmap_open(struct aesd_mmap *m, const char *path);
+
+void aesd_mmap_close(struct aesd_mmap *m);
+
+/**
+ * Copy up to @param max record descriptions into @param recs, starting with
+ * record number *@param seq, or the oldest one available if that is gone.
+ * Sets *@param seq to the number of recs[0], so the caller can tell how many
+ * records it missed.
+ * @return the number of descriptions copied
+ */
+size_t aesd_mmap_records(const struct aesd_mmap *m, uint64_t *seq,
+                         struct aesd_mmap_record *recs, size_t max);
+
+/**
+ * @return the bytes of @param rec, a description returned by aesd_mmap_records()
+ */
+static inline const char *aesd_mmap_record_data(const struct aesd_mmap *m,
+                                                const struct aesd_mmap_record *rec)
+{
+    return m->data + rec->offs % m->data_size;
+}
+
+/**
+ * @return true if the bytes of @param rec read so far were not overwritten
+ * by newer records
+ */
+bool aesd_mmap_record_intact(const struct aesd_mmap *m, const struct aesd_mmap_record *rec);
+
+#endif /* AESD_MMAP_H */
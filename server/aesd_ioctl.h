@@ -33,14 +33,164 @@ struct aesd_seekto {
     uint32_t write_cmd_offset;
 };
 
+/**
+ * Describes one stored entry, returned by AESDCHAR_IOCGETINFO
+ */
+struct aesd_entry_info {
+    /**
+     * Stream position of the first byte.  The file position of the entry, as
+     * used by read and lseek, is offs - (head_offs - total_size)
+     */
+    uint64_t offs;
+    uint64_t size;
+    /**
+     * Time the entry was completed, see struct aesd_seektime
+     */
+    uint64_t time_ns;
+};
+
+/**
+ * Passed to AESDCHAR_IOCGETINFO.  All output fields, and the entry
+ * descriptions, come from one consistent view of the device.
+ */
+struct aesd_ring_info {
+    /**
+     * In: user pointer to an array of max_entries struct aesd_entry_info, filled
+     * with the oldest min(max_entries, count) entries.  May be 0.
+     */
+    uint64_t entries;
+    /**
+     * In: number of elements at entries
+     */
+    uint32_t max_entries;
+    /**
+     * Number of entries stored
+     */
+    uint32_t count;
+    /**
+     * Bytes stored in all entries, the size of the data returned by read
+     */
+    uint64_t total_size;
+    /**
+     * Stream position following the newest entry
+     */
+    uint64_t head_offs;
+    /**
+     * Number of records completed since the driver was loaded, never decreases
+     */
+    uint64_t write_seq;
+};
+
+/**
+ * Passed to AESDCHAR_IOCSEEKTIME.  Times are CLOCK_REALTIME nanoseconds,
+ * recorded when an entry is completed.  They never decrease from one entry to
+ * the next, an entry completed while the clock was stepped back gets the time
+ * of the entry before it.
+ */
+struct aesd_seektime {
+    /**
+     * In: seek to the oldest entry completed at or after this time
+     */
+    uint64_t time_ns;
+    /**
+     * Out: time of the entry sought to, or 0 if no entry is that recent and
+     * the file was positioned at the end of the data
+     */
+    uint64_t entry_time_ns;
+    /**
+     * Out: the new file position
+     */
+    uint64_t pos;
+};
+
 // Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
 #define AESD_IOC_MAGIC 0x16
 
+/**
+ * Largest number of entries accepted by AESDCHAR_IOCRESIZE and the ring_capacity
+ * module parameter
+ */
+#define AESDCHAR_MAX_RING_CAPACITY 65536
+
 // Define a write command from the user point of view, use command number 1
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+// Resize the ring to hold the given number of entries, the most recent entries are kept
+#define AESDCHAR_IOCRESIZE _IOW(AESD_IOC_MAGIC, 2, uint32_t)
+/**
+ * Nonzero puts the open file in follow mode: reads at the end of the data wait
+ * for the next record instead of returning 0, or fail with EAGAIN if the file
+ * is non-blocking, and poll reports the file readable only once one arrived.
+ * Zero restores the default, where reads at the end return 0.
+ */
+#define AESDCHAR_IOCFOLLOW _IOW(AESD_IOC_MAGIC, 3, uint32_t)
+/**
+ * Describe the stored entries, see struct aesd_ring_info
+ */
+#define AESDCHAR_IOCGETINFO _IOWR(AESD_IOC_MAGIC, 4, struct aesd_ring_info)
+/**
+ * Seek to the first entry at or after a time, see struct aesd_seektime.  A
+ * following file positioned at the end then waits for the next record.
+ */
+#define AESDCHAR_IOCSEEKTIME _IOWR(AESD_IOC_MAGIC, 5, struct aesd_seektime)
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 5
+
+/*
+ * Read-only mmap of the device.  The first page holds a struct aesd_mmap_header,
+ * followed by the data area of header.data_size bytes, mapped twice in a row.
+ * Record bytes are stored at their stream offset modulo data_size, so a record
+ * starting at offset offs can be read in place from
+ * data + offs % data_size for size bytes, even when it wraps.
+ */
+#define AESD_MMAP_MAGIC 0x41455344 // "AESD"
+#define AESD_MMAP_VERSION 1
+
+/**
+ * Describes one record available in the mapped data area
+ */
+struct aesd_mmap_record {
+    /**
+     * Stream position of the first byte, see aesd_buffer_entry.offs
+     */
+    uint64_t offs;
+    uint32_t size;
+    /**
+     * CRC32C of the record bytes
+     */
+    uint32_t crc32c;
+};
+
+struct aesd_mmap_header {
+    uint32_t magic;
+    uint32_t version;
+    /**
+     * Odd while the driver updates the header or the data area.  Readers copy
+     * the fields they need between two reads of an even, unchanged value.
+     */
+    uint32_t seq;
+    /**
+     * Number of elements in record
+     */
+    uint32_t nr_slots;
+    /**
+     * Size of the data area, a multiple of the page size
+     */
+    uint64_t data_size;
+    /**
+     * Stream position following the newest record.  Updated before a record's
+     * bytes are copied, so bytes read in place at offs are intact if
+     * offs + data_size >= head_offs still holds after they were read.
+     */
+    uint64_t head_offs;
+    /**
+     * Records first_seq to write_seq - 1, numbered in order of completion, are
+     * described by record[seq % nr_slots]
+     */
+    uint64_t first_seq;
+    uint64_t write_seq;
+    struct aesd_mmap_record record[];
+};
 
 #endif /* AESD_IOCTL_H */
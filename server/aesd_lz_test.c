@@ -0,0 +1,277 @@
+/*
+ * Round trip inputs shaped like aesdsocket histories through aesd-lz, and
+ * check that malformed blocks are rejected.  With -c, also fetch the history
+ * from a running aesdsocket both plain and compressed, decode the compressed
+ * reply frame by frame and check that it matches.
+ *
+ * Usage: aesd_lz_test [-c host]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "aesd-lz.h"
+
+#define PORT 9000
+#define COMPRESS_PREFIX "AESDSOCKET_COMPRESS:"
+#define COMPRESS_FORMAT "lz1"
+#define BLOCK_SIZE 65536
+
+static int failures;
+
+static void fill_history(unsigned char *buf, size_t len)
+{
+    size_t i = 0;
+    unsigned int n = 0;
+
+    while (i < len) {
+        char line[64];
+        int w = snprintf(line, sizeof(line), "timestamp: Sun, 18 Oct 2026 20:%02u:%02u +0000\n",
+                         n / 60 % 60, n % 60);
+
+        n++;
+        memcpy(buf + i, line, (size_t)w < len - i ? (size_t)w : len - i);
+        i += (size_t)w < len - i ? (size_t)w : len - i;
+    }
+}
+
+static void fill_random(unsigned char *buf, size_t len, unsigned int seed)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        buf[i] = rand_r(&seed) >> 8;
+}
+
+static void round_trip(const char *what, const unsigned char *src, size_t len)
+{
+    size_t cap = AESD_LZ_BOUND(len);
+    unsigned char *comp = malloc(cap);
+    unsigned char *out = malloc(len + 1);
+    size_t comp_len, cut;
+    ssize_t out_len;
+
+    if (comp == NULL || out == NULL) {
+        printf("%s: out of memory\n", what);
+        failures++;
+        goto out;
+    }
+
+    comp_len = aesd_lz_compress(src, len, comp, cap);
+    if (comp_len == 0) {
+        printf("%s: %zu bytes did not fit in the bound of %zu\n", what, len, cap);
+        failures++;
+        goto out;
+    }
+    out_len = aesd_lz_decompress(comp, comp_len, out, len);
+    if (out_len != (ssize_t)len || memcmp(out, src, len) != 0) {
+        printf("%s: %zu bytes came back as %zd different bytes\n", what, len, out_len);
+        failures++;
+        goto out;
+    }
+    // Decompressing into a buffer one byte short must fail rather than overflow
+    if (len > 0 && aesd_lz_decompress(comp, comp_len, out, len - 1) != -1) {
+        printf("%s: decompressed into a buffer too small\n", what);
+        failures++;
+    }
+    // Truncated blocks decode to a prefix at most, never beyond the buffer
+    for (cut = 0; comp_len <= 4096 && cut < comp_len; cut++) {
+        if (aesd_lz_decompress(comp, cut, out, len) > (ssize_t)len) {
+            printf("%s: block truncated to %zu bytes overflowed\n", what, cut);
+            failures++;
+            break;
+        }
+    }
+    printf("%-24s %8zu -> %8zu bytes\n", what, len, comp_len);
+
+out:
+    free(comp);
+    free(out);
+}
+
+static void malformed(void)
+{
+    static const struct {
+        const char *what;
+        unsigned char block[8];
+        size_t len;
+    } cases[] = {
+        { "literals past the end", { 0x50, 'a', 'b' }, 3 },
+        { "match before the start", { 0x10, 'a', 0x02, 0x00 }, 4 },
+        { "zero match offset", { 0x10, 'a', 0x00, 0x00 }, 4 },
+        { "missing match offset", { 0x10, 'a', 0x01 }, 3 },
+        { "unterminated length", { 0xf0, 0xff, 0xff }, 3 },
+    };
+    unsigned char out[256];
+    size_t i;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (aesd_lz_decompress(cases[i].block, cases[i].len, out, sizeof(out)) != -1) {
+            printf("%s: malformed block accepted\n", cases[i].what);
+            failures++;
+        }
+    }
+}
+
+static int connect_server(const char *host)
+{
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    if (fd < 0 || inet_pton(AF_INET, host, &addr.sin_addr) != 1 ||
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror(host);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Send @param line to aesdsocket at @param host and read the whole reply into @param reply
+ * @return the reply length, or -1
+ */
+static ssize_t request(const char *host, const char *line, unsigned char **reply)
+{
+    size_t len = 0, cap = BLOCK_SIZE;
+    int fd = connect_server(host);
+    ssize_t n;
+
+    *reply = malloc(cap);
+    if (fd < 0 || *reply == NULL || write(fd, line, strlen(line)) != (ssize_t)strlen(line)) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    shutdown(fd, SHUT_WR);
+    while ((n = read(fd, *reply + len, cap - len)) > 0) {
+        len += n;
+        if (len == cap) {
+            unsigned char *grown = realloc(*reply, cap * 2);
+            if (grown == NULL)
+                break;
+            *reply = grown;
+            cap *= 2;
+        }
+    }
+    close(fd);
+    return n < 0 ? -1 : (ssize_t)len;
+}
+
+/**
+ * Decode the compressed reply format described in main.c
+ * @return the decoded history length, or -1 if the reply is malformed
+ */
+static ssize_t decode_reply(const unsigned char *reply, size_t len, unsigned char *out, size_t cap)
+{
+    const char *header = COMPRESS_PREFIX COMPRESS_FORMAT "\n";
+    size_t pos = strlen(header), out_len = 0;
+
+    if (len < pos || memcmp(reply, header, pos) != 0)
+        return -1;
+    while (len - pos >= 8) {
+        uint32_t raw_len, data_len;
+
+        memcpy(&raw_len, reply + pos, 4);
+        memcpy(&data_len, reply + pos + 4, 4);
+        raw_len = ntohl(raw_len);
+        data_len = ntohl(data_len);
+        pos += 8;
+        if (raw_len == 0 && data_len == 0)
+            return pos == len ? (ssize_t)out_len : -1;
+        if (raw_len > BLOCK_SIZE || data_len > len - pos || raw_len > cap - out_len)
+            return -1;
+        if (data_len == raw_len)
+            memcpy(out + out_len, reply + pos, raw_len);
+        else if (aesd_lz_decompress(reply + pos, data_len, out + out_len, raw_len) != raw_len)
+            return -1;
+        out_len += raw_len;
+        pos += data_len;
+    }
+    return -1;
+}
+
+static void check_server(const char *host)
+{
+    unsigned char *plain = NULL, *compressed = NULL, *decoded = NULL;
+    ssize_t plain_len, compressed_len, decoded_len;
+
+    // A bare compress command stores nothing, the plain request then stores its line
+    // and returns the same history followed by it
+    compressed_len = request(host, COMPRESS_PREFIX "\n", &compressed);
+    plain_len = request(host, "aesd_lz_test record\n", &plain);
+    if (compressed_len < 0 || plain_len < 0) {
+        printf("%s: request failed\n", host);
+        failures++;
+        goto out;
+    }
+
+    // Anything decoding to more than the plain reply is wrong as well
+    decoded = malloc(plain_len + 1);
+    decoded_len = decoded ? decode_reply(compressed, compressed_len, decoded, plain_len) : -1;
+    if (decoded_len < 0) {
+        printf("%s: malformed or oversized compressed reply\n", host);
+        failures++;
+    } else if (plain_len < decoded_len || memcmp(plain, decoded, decoded_len) != 0) {
+        printf("%s: compressed reply does not match the history\n", host);
+        failures++;
+    } else {
+        printf("%s: %zd history bytes in %zd compressed reply bytes\n", host,
+               decoded_len, compressed_len);
+    }
+
+out:
+    free(plain);
+    free(compressed);
+    free(decoded);
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t sizes[] = { 0, 1, 3, 4, 5, 15, 16, 300, 4096, BLOCK_SIZE, 3 * BLOCK_SIZE };
+    const char *host = NULL;
+    unsigned char *buf = malloc(3 * BLOCK_SIZE);
+    char what[64];
+    size_t i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:")) != -1) {
+        switch (opt) {
+        case 'c': host = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-c host]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (buf == NULL)
+        return 1;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        fill_history(buf, sizes[i]);
+        snprintf(what, sizeof(what), "history %zu", sizes[i]);
+        round_trip(what, buf, sizes[i]);
+
+        fill_random(buf, sizes[i], i);
+        snprintf(what, sizeof(what), "random %zu", sizes[i]);
+        round_trip(what, buf, sizes[i]);
+
+        memset(buf, 'a', sizes[i]);
+        snprintf(what, sizeof(what), "run %zu", sizes[i]);
+        round_trip(what, buf, sizes[i]);
+    }
+
+    malformed();
+    if (host != NULL)
+        check_server(host);
+
+    free(buf);
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * Check that records read in place through aesd-mmap match those returned by
+ * read() on the aesdchar device.
+ *
+ * Usage: aesd_mmap_test [device] [records]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "aesd-mmap.h"
+#include "aesd-crc32c.h"
+
+#define MAX_RECORDS 1024
+#define HISTORY_SIZE (4 * 1024 * 1024)
+
+static int check_records(const struct aesd_mmap *m, const char *history, size_t history_len,
+                         uint64_t *seq)
+{
+    static struct aesd_mmap_record recs[MAX_RECORDS];
+    uint64_t first = *seq;
+    size_t n = aesd_mmap_records(m, &first, recs, MAX_RECORDS);
+    size_t total = 0, i;
+    const char *tail;
+
+    for (i = 0; i < n; i++)
+        total += recs[i].size;
+    if (total > history_len) {
+        printf("mmap describes %zu bytes, read returned only %zu\n", total, history_len);
+        return -1;
+    }
+
+    // The mapped records are the newest ones, in order
+    tail = history + history_len - total;
+    for (i = 0; i < n; i++) {
+        const char *data = aesd_mmap_record_data(m, &recs[i]);
+
+        if (aesd_crc32c(0, data, recs[i].size) != recs[i].crc32c ||
+            memcmp(data, tail, recs[i].size) != 0 || !aesd_mmap_record_intact(m, &recs[i])) {
+            printf("Record %llu differs from read()\n", (unsigned long long)(first + i));
+            return -1;
+        }
+        tail += recs[i].size;
+    }
+
+    printf("%zu records from %llu, %zu bytes match read()\n", n,
+           (unsigned long long)first, total);
+    *seq = first + n;
+    return 0;
+}
+
+static ssize_t read_history(const char *device, char *buf, size_t len)
+{
+    size_t total = 0;
+    ssize_t n;
+    int fd = open(device, O_RDONLY);
+
+    if (fd < 0)
+        return -1;
+    while (total < len && (n = read(fd, buf + total, len - total)) > 0)
+        total += n;
+    close(fd);
+    return total;
+}
+
+static int write_records(const char *device, int first, int count)
+{
+    char line[64];
+    int fd = open(device, O_WRONLY);
+    int i;
+
+    if (fd < 0)
+        return -1;
+    for (i = first; i < first + count; i++) {
+        int len = snprintf(line, sizeof(line), "aesd_mmap_test record %d\n", i);
+
+        if (write(fd, line, len) != len) {
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *device = argc > 1 ? argv[1] : "/dev/aesdchar";
+    int records = argc > 2 ? atoi(argv[2]) : 5;
+    char *history = malloc(HISTORY_SIZE);
+    struct aesd_mmap m;
+    uint64_t seq = 0;
+    ssize_t len;
+
+    if (history == NULL)
+        return 1;
+
+    if (write_records(device, 0, records) < 0) {
+        perror(device);
+        return 1;
+    }
+    if (aesd_mmap_open(&m, device) < 0) {
+        perror("aesd_mmap_open");
+        return 1;
+    }
+    printf("Mapped %llu byte data area, %u record slots\n",
+           (unsigned long long)m.data_size, m.hdr->nr_slots);
+
+    len = read_history(device, history, HISTORY_SIZE);
+    if (len < 0 || check_records(&m, history, len, &seq) < 0)
+        goto fail;
+
+    // Records written after mapping show up without mapping again
+    if (write_records(device, records, records) < 0) {
+        perror(device);
+        goto fail;
+    }
+    len = read_history(device, history, HISTORY_SIZE);
+    seq = 0;
+    if (len < 0 || check_records(&m, history, len, &seq) < 0)
+        goto fail;
+
+    aesd_mmap_close(&m);
+    free(history);
+    printf("aesd_mmap_test passed\n");
+    return 0;
+
+fail:
+    aesd_mmap_close(&m);
+    free(history);
+    return 1;
+}
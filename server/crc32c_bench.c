@@ -0,0 +1,116 @@
+/*
+ * Compare the cost of checksumming records with the cost of appending them
+ * to the history file, the way aesdsocket does for each received line: the
+ * data is written and flushed, then an index record is appended to a second
+ * file opened for the purpose, as append_record() in main.c does.
+ *
+ * Appending a large record to the page cache is itself a memory copy, which
+ * a checksum reading every byte cannot be made negligible against, so the
+ * cost column stays under 1% only for line sized records.
+ *
+ * Usage: crc32c_bench [data_file]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include "aesd-crc32c.h"
+
+#define TOTAL_BYTES (64 * 1024 * 1024)
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double bench_crc(uint32_t (*fn)(uint32_t, const void *, size_t),
+                        const char *buf, size_t record_size)
+{
+    size_t records = TOTAL_BYTES / record_size;
+    volatile uint32_t sink = 0;
+    double start = now_sec();
+    size_t i;
+
+    for (i = 0; i < records; i++)
+        sink ^= fn(0, buf, record_size);
+    (void)sink;
+    return now_sec() - start;
+}
+
+/**
+ * Time appending records the way append_record() does, less the checksum
+ */
+static double bench_append(const char *path, const char *buf, size_t record_size)
+{
+    size_t records = TOTAL_BYTES / record_size;
+    struct {
+        uint64_t offset;
+        uint32_t length;
+        uint32_t crc;
+    } rec = { 0, record_size, 0 };
+    char index_path[4096];
+    double start, elapsed;
+    FILE *out;
+    size_t i;
+
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+    out = fopen(path, "a+");
+    if (out == NULL) {
+        perror(path);
+        exit(1);
+    }
+    start = now_sec();
+    for (i = 0; i < records; i++) {
+        int fd;
+
+        fseek(out, 0, SEEK_END);
+        rec.offset = ftell(out);
+        fwrite(buf, 1, record_size, out);
+        fflush(out);
+        fd = open(index_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0 || write(fd, &rec, sizeof(rec)) != sizeof(rec)) {
+            perror(index_path);
+            exit(1);
+        }
+        close(fd);
+    }
+    elapsed = now_sec() - start;
+    fclose(out);
+    remove(path);
+    remove(index_path);
+    return elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t sizes[] = { 32, 128, 1024, 16384, 262144 };
+    const char *path = argc > 1 ? argv[1] : "/var/tmp/crc32c_bench.dat";
+    char *buf = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+    size_t i;
+
+    if (buf == NULL)
+        return 1;
+    for (i = 0; i < sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]; i++)
+        buf[i] = 'a' + i % 26;
+
+    printf("crc32c implementation: %s\n", aesd_crc32c_impl());
+    printf("%10s %12s %12s %12s %10s\n",
+           "record", "crc MB/s", "table MB/s", "append MB/s", "crc cost");
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        double t_crc = bench_crc(aesd_crc32c, buf, sizes[i]);
+        double t_sw = bench_crc(aesd_crc32c_sw, buf, sizes[i]);
+        double t_append = bench_append(path, buf, sizes[i]);
+        double mb = TOTAL_BYTES / 1e6;
+
+        printf("%10zu %12.0f %12.0f %12.0f %9.2f%%\n", sizes[i],
+               mb / t_crc, mb / t_sw, mb / t_append, 100.0 * t_crc / t_append);
+    }
+
+    free(buf);
+    return 0;
+}
@@ -5,8 +5,84 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <errno.h>
+#include <time.h>
 #include "aesd_ioctl.h"
 
+/*
+ * Print the entries of the device with AESDCHAR_IOCGETINFO, then read exactly
+ * the number of bytes it reported
+ */
+static int print_info(int fd)
+{
+    struct aesd_ring_info info;
+    struct aesd_entry_info *entries;
+    char *data;
+    ssize_t bytes_read;
+    uint32_t i;
+
+    // Ask for the counts first, then for as many entries as there are
+    memset(&info, 0, sizeof(info));
+    if (ioctl(fd, AESDCHAR_IOCGETINFO, &info) < 0) {
+        perror("IOCTL failed");
+        return 1;
+    }
+    entries = calloc(info.count + 1, sizeof(*entries));
+    if (entries == NULL)
+        return 1;
+    info.entries = (uintptr_t)entries;
+    info.max_entries = info.count + 1;
+    if (ioctl(fd, AESDCHAR_IOCGETINFO, &info) < 0) {
+        perror("IOCTL failed");
+        free(entries);
+        return 1;
+    }
+
+    printf("%u entries, %llu bytes, %llu records written\n", info.count,
+           (unsigned long long)info.total_size, (unsigned long long)info.write_seq);
+    for (i = 0; i < info.count && i < info.max_entries; i++)
+        printf("  entry %u: file position %llu, %llu bytes, time %llu.%09llu\n", i,
+               (unsigned long long)(entries[i].offs - (info.head_offs - info.total_size)),
+               (unsigned long long)entries[i].size,
+               (unsigned long long)(entries[i].time_ns / 1000000000),
+               (unsigned long long)(entries[i].time_ns % 1000000000));
+
+    data = malloc(info.total_size + 1);
+    if (data == NULL) {
+        free(entries);
+        return 1;
+    }
+    bytes_read = pread(fd, data, info.total_size, 0);
+    printf("Read %zd of %llu bytes\n", bytes_read, (unsigned long long)info.total_size);
+
+    free(data);
+    free(entries);
+    return bytes_read < 0;
+}
+
+/*
+ * Print the entries completed in the last @seconds, found with AESDCHAR_IOCSEEKTIME
+ */
+static int print_since(int fd, unsigned int seconds)
+{
+    struct aesd_seektime seektime;
+    struct timespec now;
+    char buffer[1024];
+    ssize_t bytes_read;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    seektime.time_ns = (uint64_t)(now.tv_sec - seconds) * 1000000000 + now.tv_nsec;
+    if (ioctl(fd, AESDCHAR_IOCSEEKTIME, &seektime) < 0) {
+        perror("IOCTL failed");
+        return 1;
+    }
+    printf("Entries since %u seconds ago start at file position %llu\n", seconds,
+           (unsigned long long)seektime.pos);
+
+    while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0)
+        fwrite(buffer, 1, bytes_read, stdout);
+    return bytes_read < 0;
+}
+
 int main(int argc, char *argv[])
 {
     int fd;
@@ -14,8 +90,24 @@ int main(int argc, char *argv[])
     char buffer[1024];
     ssize_t bytes_read;
     
+    if ((argc == 2 && strcmp(argv[1], "info") == 0) ||
+        (argc == 3 && strcmp(argv[1], "since") == 0)) {
+        int ret;
+
+        fd = open("/dev/aesdchar", O_RDONLY);
+        if (fd < 0) {
+            perror("Failed to open /dev/aesdchar");
+            return 1;
+        }
+        ret = argc == 2 ? print_info(fd) : print_since(fd, atoi(argv[2]));
+        close(fd);
+        return ret;
+    }
+
     if (argc != 3) {
         printf("Usage: %s <write_cmd> <write_cmd_offset>\n", argv[0]);
+        printf("       %s info\n", argv[0]);
+        printf("       %s since <seconds>\n", argv[0]);
         printf("Example: %s 1 2\n", argv[0]);
         return 1;
     }
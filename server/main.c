@@ -14,6 +14,9 @@
 #include <fcntl.h>
 #include <time.h>
 #include <pthread.h>
+#include <stdint.h>
+#include "aesd-lz.h"
+#include "aesd-crc32c.h"
 #if USE_AESD_CHAR_DEVICE
 #include <sys/ioctl.h>
 #include "aesd_ioctl.h"
@@ -25,12 +28,77 @@
 #define FILENAME "/dev/aesdchar"
 #else
 #define FILENAME "/var/tmp/aesdsocketdata"
+#define INDEX_FILENAME FILENAME ".idx"
+#endif
+
+/*
+ * Clients opt in to compressed replies by prefixing their line with
+ * COMPRESS_PREFIX.  The remainder of the line is stored as usual (a bare
+ * newline stores nothing) and the history is returned as:
+ *   "AESDSOCKET_COMPRESS:lz1\n"
+ *   frames of { uint32 raw_len, uint32 data_len (network order), data }
+ *   a terminating frame with raw_len == data_len == 0
+ * A frame whose data_len equals raw_len carries the block uncompressed.
+ */
+#define COMPRESS_PREFIX "AESDSOCKET_COMPRESS:"
+#define COMPRESS_FORMAT "lz1"
+#define LZ_BLOCK_SIZE 65536
+
+#if !USE_AESD_CHAR_DEVICE
+/*
+ * Compressed copies of full LZ_BLOCK_SIZE history blocks, block i covering
+ * the bytes at i * LZ_BLOCK_SIZE.  The history file is append only and its
+ * intact prefix never changes once verified, so a full block is identified by
+ * its position alone.  The aesdchar device evicts old entries, which shifts
+ * every block boundary, so nothing is cached in that mode.
+ */
+struct lz_cache_block {
+    unsigned char *data;
+    size_t data_len;
+};
+static struct lz_cache_block *lz_cache = NULL;
+static size_t lz_cache_len = 0;
+
+/*
+ * Every record appended to FILENAME gets an entry in INDEX_FILENAME so torn
+ * or corrupted records can be detected after an unclean shutdown.
+ */
+struct history_index_record {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t crc;
+};
+
+/*
+ * Leading records of FILENAME whose checksums already passed.  The file is
+ * append only, so records are checked once when first read and skipped after.
+ */
+static size_t verified_records = 0;
+static uint64_t verified_bytes = 0;
+
+/*
+ * INDEX_FILENAME opened for appending by append_record(), kept open between records
+ */
+static int index_fd = -1;
 #endif
 
 int sockfd=-1, client_fd=-1;
 FILE *client_stream=NULL, *aesd_outfile=NULL;
 pthread_mutex_t file_mutex;
 
+#if !USE_AESD_CHAR_DEVICE
+static void lz_cache_free(void)
+{
+    size_t i;
+
+    for (i = 0; i < lz_cache_len; i++)
+        free(lz_cache[i].data);
+    free(lz_cache);
+    lz_cache = NULL;
+    lz_cache_len = 0;
+}
+#endif
+
 void cleanup(bool all) {
     if (client_stream != NULL) {
         fclose(client_stream);
@@ -54,12 +122,225 @@ void cleanup(bool all) {
         }
 
 #if !USE_AESD_CHAR_DEVICE
+        if (index_fd != -1) {
+            close(index_fd);
+            index_fd = -1;
+        }
         remove(FILENAME);
+        remove(INDEX_FILENAME);
+        lz_cache_free();
 #endif
         closelog(); 
     }
 }
 
+#if !USE_AESD_CHAR_DEVICE
+/**
+ * Append @param len bytes at @param data to the history stream @param out
+ * as one record and add its checksum to the index.  On failure the data and
+ * index files are both rolled back to where they were, so no bytes are left
+ * behind which the index does not describe.
+ * @return 0, or -1 if the record could not be stored
+ */
+static int append_record(FILE *out, const char *data, size_t len)
+{
+    struct history_index_record rec;
+    int data_fd = fileno(out);
+    off_t index_size = -1;
+    size_t done = 0;
+    ssize_t n;
+
+    // Flushes and drops whatever the stream buffered, the data is written below it
+    fseek(out, 0, SEEK_END);
+    rec.offset = ftell(out);
+    rec.length = len;
+    rec.crc = aesd_crc32c(0, data, len);
+
+    // Data goes out first so the index never describes bytes which were not written
+    while (done < len) {
+        n = write(data_fd, data + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            syslog(LOG_ERR, "Could not append record: %s", strerror(n < 0 ? errno : EIO));
+            goto rollback;
+        }
+        done += n;
+    }
+
+    if (index_fd == -1) {
+        index_fd = open(INDEX_FILENAME, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (index_fd == -1) {
+            syslog(LOG_ERR, "Could not open index: %s", strerror(errno));
+            goto rollback;
+        }
+    }
+    index_size = lseek(index_fd, 0, SEEK_END);
+    do {
+        n = write(index_fd, &rec, sizeof(rec));
+    } while (n < 0 && errno == EINTR);
+    if (n != sizeof(rec)) {
+        syslog(LOG_ERR, "Could not append index record: %s", strerror(n < 0 ? errno : EIO));
+        goto rollback;
+    }
+    return 0;
+
+rollback:
+    if (ftruncate(data_fd, rec.offset) != 0 ||
+        (index_size >= 0 && ftruncate(index_fd, index_size) != 0))
+        syslog(LOG_ERR, "Could not roll back record: %s", strerror(errno));
+    clearerr(out);
+    fseek(out, 0, SEEK_END);
+    return -1;
+}
+
+/**
+ * Remove record @param record, described by @param bad, from the history: the
+ * data after it moves down over it and the index entries after it are shifted
+ * to match.  Records after a damaged one stay readable this way, and the
+ * history stays a contiguous run of intact records which is only appended to.
+ * @return 0, or -1 if the files could not be rewritten
+ */
+static int drop_record(const struct history_index_record *bad, size_t record)
+{
+    struct history_index_record rec;
+    char buffer[4096];
+    uint64_t pos = bad->offset + bad->length;
+    size_t next = record + 1;
+    int data_fd, index_fd;
+    ssize_t n = 0;
+    int rc = -1;
+
+    // FILENAME is opened for append elsewhere, which would ignore pwrite() offsets
+    data_fd = open(FILENAME, O_RDWR);
+    index_fd = open(INDEX_FILENAME, O_RDWR);
+    if (data_fd < 0 || index_fd < 0)
+        goto out;
+
+    while ((n = pread(data_fd, buffer, sizeof(buffer), pos)) > 0) {
+        if (pwrite(data_fd, buffer, n, pos - bad->length) != n)
+            goto out;
+        pos += n;
+    }
+    if (n < 0 || ftruncate(data_fd, pos - bad->length) != 0)
+        goto out;
+
+    while (pread(index_fd, &rec, sizeof(rec), next * sizeof(rec)) == sizeof(rec)) {
+        rec.offset -= bad->length;
+        if (pwrite(index_fd, &rec, sizeof(rec), (next - 1) * sizeof(rec)) != sizeof(rec))
+            goto out;
+        next++;
+    }
+    if (ftruncate(index_fd, (next - 1) * sizeof(rec)) != 0)
+        goto out;
+    rc = 0;
+
+out:
+    if (rc != 0)
+        syslog(LOG_ERR, "Could not drop record %zu: %s", record, strerror(errno));
+    if (data_fd >= 0)
+        close(data_fd);
+    if (index_fd >= 0)
+        close(index_fd);
+    return rc;
+}
+
+/**
+ * Check the checksums of records in @param data_fd past the verified prefix.
+ * Records whose checksum does not match are dropped, see drop_record().
+ * @param recover if true, truncate the data and index files after the last intact record
+ * @return the number of leading bytes of the history covered by intact records
+ */
+static uint64_t verify_history(int data_fd, bool recover)
+{
+    struct history_index_record rec;
+    char buffer[4096];
+    int index_fd = open(INDEX_FILENAME, O_RDONLY);
+
+    if (index_fd >= 0) {
+        // pread() rather than stdio, drop_record() rewrites the index under us
+        while (pread(index_fd, &rec, sizeof(rec), verified_records * sizeof(rec)) == sizeof(rec)) {
+            uint32_t crc = 0;
+            uint64_t pos = rec.offset;
+            uint64_t end = rec.offset + rec.length;
+
+            // Records are contiguous, anything else means the index itself is damaged
+            if (rec.offset != verified_bytes)
+                break;
+
+            while (pos < end) {
+                size_t want = end - pos < sizeof(buffer) ? end - pos : sizeof(buffer);
+                ssize_t got = pread(data_fd, buffer, want, pos);
+                if (got <= 0)
+                    break;
+                crc = aesd_crc32c(crc, buffer, got);
+                pos += got;
+            }
+            // Data is written before its index entry, so only a crash leaves a torn
+            // record, and only at the end where recovery truncates it
+            if (pos != end) {
+                syslog(LOG_ERR, "Record %zu at offset %llu is truncated",
+                       verified_records, (unsigned long long)rec.offset);
+                break;
+            }
+            if (crc != rec.crc) {
+                syslog(LOG_ERR, "Checksum mismatch in record %zu at offset %llu, dropping it",
+                       verified_records, (unsigned long long)rec.offset);
+                // The next record now sits where this one was
+                if (drop_record(&rec, verified_records) == 0)
+                    continue;
+                break;
+            }
+
+            verified_records++;
+            verified_bytes = end;
+        }
+        close(index_fd);
+    }
+
+    if (recover) {
+        if (ftruncate(data_fd, verified_bytes) != 0 ||
+            truncate(INDEX_FILENAME, verified_records * sizeof(rec)) != 0) {
+            if (errno != ENOENT)
+                syslog(LOG_ERR, "Could not truncate history: %s", strerror(errno));
+        }
+    }
+    return verified_bytes;
+}
+
+/**
+ * Keep the intact records left behind by an unclean shutdown, dropping
+ * corrupted ones and anything after a torn one
+ */
+static void recover_history(void)
+{
+    int fd = open(FILENAME, O_RDWR);
+
+    if (fd < 0)
+        return;
+    verify_history(fd, true);
+    syslog(LOG_INFO, "Recovered %zu records (%llu bytes) from %s",
+           verified_records, (unsigned long long)verified_bytes, FILENAME);
+    close(fd);
+}
+
+/**
+ * Send the first @param limit bytes of @param history to the client
+ */
+static void send_history(FILE *client_stream, FILE *history, uint64_t limit)
+{
+    char buffer[1024];
+    size_t n;
+
+    while (limit > 0 &&
+           (n = fread(buffer, 1, limit < sizeof(buffer) ? limit : sizeof(buffer), history)) > 0) {
+        fwrite(buffer, 1, n, client_stream);
+        limit -= n;
+    }
+    fflush(client_stream);
+}
+#endif
+
 void* timer_thread_func(void* arg){
     while(1){
         sleep(10);
@@ -78,13 +359,198 @@ void* timer_thread_func(void* arg){
             syslog(LOG_ERR, "Could not make aesd outfile stream: %s", strerror(errno));
             cleanup(true);
         }
+#if USE_AESD_CHAR_DEVICE
         fprintf(aesd_outfile, "%s", timestamp_str);
+#else
+        if (append_record(aesd_outfile, timestamp_str, strlen(timestamp_str)) != 0)
+            syslog(LOG_ERR, "Timestamp was not stored");
+#endif
         cleanup(false);
         pthread_mutex_unlock(&file_mutex);
     }
 }
 
+/**
+ * Check if the received string asks for a compressed reply
+ */
+static bool is_compress_command(const char *buffer)
+{
+    return strncmp(buffer, COMPRESS_PREFIX, strlen(COMPRESS_PREFIX)) == 0;
+}
+
+/**
+ * @return the part of a compress command which should be stored, or NULL if
+ * the command only fetches the history
+ */
+static const char *compress_command_payload(const char *line)
+{
+    const char *payload = line + strlen(COMPRESS_PREFIX);
+
+    if (*payload == '\0' || strcmp(payload, "\n") == 0)
+        return NULL;
+    return payload;
+}
+
+#if !USE_AESD_CHAR_DEVICE
+/**
+ * Remember the compressed form of full history block @param index
+ */
+static void lz_cache_store(size_t index, const unsigned char *data, size_t data_len)
+{
+    unsigned char *copy;
+
+    if (index >= lz_cache_len) {
+        size_t new_len = index + 1 > lz_cache_len * 2 ? index + 1 : lz_cache_len * 2;
+        struct lz_cache_block *grown = realloc(lz_cache, new_len * sizeof(*grown));
+        if (grown == NULL)
+            return;
+        memset(grown + lz_cache_len, 0, (new_len - lz_cache_len) * sizeof(*grown));
+        lz_cache = grown;
+        lz_cache_len = new_len;
+    }
+
+    copy = malloc(data_len);
+    if (copy == NULL)
+        return;
+    memcpy(copy, data, data_len);
+
+    free(lz_cache[index].data);
+    lz_cache[index].data = copy;
+    lz_cache[index].data_len = data_len;
+}
+#endif
+
+static int send_frame(FILE *client_stream, size_t raw_len,
+                      const unsigned char *data, size_t data_len)
+{
+    uint32_t hdr[2] = { htonl(raw_len), htonl(data_len) };
+
+    if (fwrite(hdr, sizeof(hdr), 1, client_stream) != 1)
+        return -1;
+    if (data_len && fwrite(data, 1, data_len, client_stream) != data_len)
+        return -1;
+    return 0;
+}
+
+/**
+ * Send up to @param limit bytes of @param history to the client in the
+ * compressed reply format described at COMPRESS_PREFIX
+ */
+static int send_compressed_history(FILE *client_stream, FILE *history, uint64_t limit)
+{
+    unsigned char *raw = malloc(LZ_BLOCK_SIZE);
+    unsigned char *comp = malloc(AESD_LZ_BOUND(LZ_BLOCK_SIZE));
+    size_t index = 0;
+    size_t raw_len;
+    int rc = 0;
+
+    if (raw == NULL || comp == NULL) {
+        syslog(LOG_ERR, "Could not allocate compression buffers");
+        free(raw);
+        free(comp);
+        return -1;
+    }
+
+    fprintf(client_stream, "%s%s\n", COMPRESS_PREFIX, COMPRESS_FORMAT);
+
+    while (rc == 0 && limit > 0) {
+        const unsigned char *data = comp;
+        size_t data_len;
+
+#if !USE_AESD_CHAR_DEVICE
+        // A full block already compressed is sent without reading it again
+        if (limit >= LZ_BLOCK_SIZE && index < lz_cache_len && lz_cache[index].data != NULL &&
+            fseek(history, LZ_BLOCK_SIZE, SEEK_CUR) == 0) {
+            rc = send_frame(client_stream, LZ_BLOCK_SIZE, lz_cache[index].data,
+                            lz_cache[index].data_len);
+            index++;
+            limit -= LZ_BLOCK_SIZE;
+            continue;
+        }
+#endif
+
+        raw_len = fread(raw, 1, limit < LZ_BLOCK_SIZE ? limit : LZ_BLOCK_SIZE, history);
+        if (raw_len == 0)
+            break;
+        data_len = aesd_lz_compress(raw, raw_len, comp, AESD_LZ_BOUND(LZ_BLOCK_SIZE));
+        if (data_len == 0 || data_len >= raw_len) {
+            data = raw;
+            data_len = raw_len;
+        }
+#if !USE_AESD_CHAR_DEVICE
+        if (raw_len == LZ_BLOCK_SIZE)
+            lz_cache_store(index, data, data_len);
+#endif
+        rc = send_frame(client_stream, raw_len, data, data_len);
+        index++;
+        limit -= raw_len;
+    }
+
+    if (rc == 0)
+        rc = send_frame(client_stream, 0, NULL, 0);
+    if (rc != 0)
+        syslog(LOG_ERR, "Failed to send compressed data to client");
+
+    fflush(client_stream);
+    free(raw);
+    free(comp);
+    return rc;
+}
+
 #if USE_AESD_CHAR_DEVICE
+/**
+ * Send the device history, as it stood when called, through a fixed size buffer.
+ * Reads are positioned by file offset, which counts from the oldest stored byte, so
+ * AESDCHAR_IOCGETINFO is asked again after every read: if writers evicted entries
+ * meanwhile the offsets have shifted, and the read is repeated at the new offset.
+ * @return 0, or -1 if the device does not support the ioctl and nothing was sent
+ */
+static int send_device_history(FILE *client_stream, int device_fd)
+{
+    struct aesd_ring_info info;
+    uint64_t oldest, pos, end;
+    char buffer[4096];
+    ssize_t n;
+
+    memset(&info, 0, sizeof(info));
+    if (ioctl(device_fd, AESDCHAR_IOCGETINFO, &info) < 0)
+        return -1;
+    oldest = info.head_offs - info.total_size;
+    end = info.head_offs;
+
+    for (pos = oldest; pos < end; ) {
+        size_t want = end - pos < sizeof(buffer) ? end - pos : sizeof(buffer);
+        uint64_t now_oldest;
+
+        n = pread(device_fd, buffer, want, pos - oldest);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 || ioctl(device_fd, AESDCHAR_IOCGETINFO, &info) < 0) {
+            syslog(LOG_ERR, "Failed to read device history: %s", strerror(errno));
+            break;
+        }
+
+        // The stream position of the oldest byte only grows, unchanged means no eviction
+        now_oldest = info.head_offs - info.total_size;
+        if (now_oldest != oldest) {
+            oldest = now_oldest;
+            if (pos < oldest) {
+                syslog(LOG_WARNING, "%llu history bytes were evicted before they could be sent",
+                       (unsigned long long)(oldest - pos));
+                pos = oldest;
+            }
+            continue;
+        }
+        if (n == 0)
+            break;
+
+        fwrite(buffer, 1, n, client_stream);
+        pos += n;
+    }
+    fflush(client_stream);
+    return 0;
+}
+
 /**
  * Check if the received string is an IOCTL command
  */
@@ -225,6 +691,8 @@ int main(int argc, char *argv[]) {
 #if !USE_AESD_CHAR_DEVICE
     pthread_t timer_thread;
 
+    recover_history();
+
     if (pthread_create(&timer_thread, NULL, timer_thread_func, NULL) != 0) {
         cleanup(true);
         return 1;
@@ -307,16 +775,25 @@ int main(int argc, char *argv[]) {
                     return -1;
                 }
                 
-                fprintf(aesd_outfile, "%s", line);
-                fflush(aesd_outfile);
+                bool compressed = is_compress_command(line);
+                const char *payload = compressed ? compress_command_payload(line) : line;
+
+                if (payload != NULL) {
+                    fprintf(aesd_outfile, "%s", payload);
+                    fflush(aesd_outfile);
+                }
 
                 fseek(aesd_outfile, 0, SEEK_SET);
 
-                char buffer[1024];
-                while (fgets(buffer, sizeof(buffer), aesd_outfile) != NULL) {
-                    fputs(buffer, client_stream);
+                if (compressed) {
+                    send_compressed_history(client_stream, aesd_outfile, UINT64_MAX);
+                } else if (send_device_history(client_stream, fileno(aesd_outfile)) < 0) {
+                    char buffer[1024];
+                    while (fgets(buffer, sizeof(buffer), aesd_outfile) != NULL) {
+                        fputs(buffer, client_stream);
+                    }
+                    fflush(client_stream);
                 }
-                fflush(client_stream);
             }
         }
 #else
@@ -331,16 +808,22 @@ int main(int argc, char *argv[]) {
         char *line = NULL;
         size_t len = 0;
         getline(&line, &len, client_stream);
-        fprintf(aesd_outfile, "%s", line);
-        fflush(aesd_outfile);
+        bool compressed = line != NULL && is_compress_command(line);
+        const char *payload = compressed ? compress_command_payload(line) : line;
+
+        if (payload != NULL && append_record(aesd_outfile, payload, strlen(payload)) != 0)
+            syslog(LOG_ERR, "Record from %s was not stored", inet_ntoa(client_addr.sin_addr));
+
+        // Only records whose checksums pass are returned to the client
+        uint64_t intact = verify_history(fileno(aesd_outfile), false);
 
         fseek(aesd_outfile, 0, SEEK_SET);
 
-        char buffer[1024];
-        while (fgets(buffer, sizeof(buffer), aesd_outfile) != NULL) {
-            fputs(buffer, client_stream);
+        if (compressed) {
+            send_compressed_history(client_stream, aesd_outfile, intact);
+        } else {
+            send_history(client_stream, aesd_outfile, intact);
         }
-        fflush(client_stream);
         
         free(line);
 #endif